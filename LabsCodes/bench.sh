@@ -0,0 +1,106 @@
+#!/bin/bash
+#
+# Usage: bench.sh [program ...]
+#
+# Runs the serial and OpenMP builds of the Makefile (make first) over a
+# few problem sizes and OMP_NUM_THREADS values, and writes CSV to stdout:
+#
+#   program,size,variant,threads,seconds,speedup,efficiency
+#
+# SIZE is the problem size, or for schedule the loop schedule; critical
+# is timed with the private update only.  SECONDS is the best wall time
+# of REPS runs.  SPEEDUP is the time of the serial build at the same
+# size over SECONDS, and EFFICIENCY is SPEEDUP over THREADS.
+#
+# Environment: THREADS, the thread counts, powers of two up to nproc
+# and nproc by default; REPS, the runs per point, 3 by default.
+
+cd "$(dirname "$0")" || exit 1
+
+PROGRAMS=${*:-"pi mult mxm mandel jacobi md swim task critical schedule"}
+REPS=${REPS:-3}
+if [ -z "$THREADS" ]; then
+    n=$(nproc)
+    t=1
+    while [ $t -lt $n ]; do
+        THREADS="$THREADS $t"
+        t=$((t * 2))
+    done
+    THREADS="$THREADS $n"
+fi
+
+# The problem sizes of each program, then the arguments for one size
+sizes() {
+    case $1 in
+    pi)       echo "100000000 1000000000" ;;
+    mult)     echo "800 1600" ;;
+    mxm)      echo "600 1200" ;;
+    mandel)   echo "1024 4096" ;;
+    jacobi)   echo "500 1000 2000" ;;
+    md)       echo "1000 4000" ;;
+    swim)     echo "test train" ;;
+    task)     echo "16 1" ;;
+    critical) echo "10000 10" ;;
+    schedule) echo "static dynamic balanced" ;;
+    esac
+}
+
+args() {
+    case $1 in
+    pi|mult|mxm) echo "$2" ;;
+    mandel)      echo "-x $2 -y $2" ;;
+    jacobi)      echo "-n $2 -m $2" ;;
+    md)          echo "-n $2" ;;
+    task)        echo "-g $2" ;;
+    critical)    echo "-m private -k $2" ;;
+    schedule)    echo "$2" ;;
+    esac
+}
+
+# Best wall time of REPS runs of "$@"; swim runs in a scratch directory
+# holding swim.in for the size in $SWIMIN
+best() {
+    local b= r s e
+    for ((r = 0; r < REPS; r++)); do
+        s=$(date +%s%N)
+        if [ -n "$SWIMIN" ]; then
+            (cd "$SWIMDIR" && "$@") > /dev/null 2>&1 || return 1
+        else
+            "$@" > /dev/null 2>&1 || return 1
+        fi
+        e=$(date +%s%N)
+        if [ -z "$b" ] || [ $((e - s)) -lt "$b" ]; then
+            b=$((e - s))
+        fi
+    done
+    awk -v ns="$b" 'BEGIN { printf "%.6f\n", ns / 1e9 }'
+}
+
+for f in $PROGRAMS; do
+    if [ ! -x bin/omp/$f ] || [ ! -x bin/serial/$f ]; then
+        echo "bench.sh: no bin/omp/$f or bin/serial/$f, run make" >&2
+        exit 1
+    fi
+done
+
+SWIMDIR=$(mktemp -d)
+trap 'rm -rf "$SWIMDIR"' EXIT
+
+echo "program,size,variant,threads,seconds,speedup,efficiency"
+for f in $PROGRAMS; do
+    for size in $(sizes $f); do
+        SWIMIN=
+        if [ $f = swim ]; then
+            SWIMIN=swim/data/swim.in.$size
+            cp "$SWIMIN" "$SWIMDIR/swim.in"
+        fi
+        a=$(args $f $size)
+        ts=$(best "$PWD/bin/serial/$f" $a) || { echo "bench.sh: $f $a failed" >&2; continue; }
+        echo "$f,$size,serial,1,$ts,1.000,1.000"
+        for t in $THREADS; do
+            tp=$(OMP_NUM_THREADS=$t best "$PWD/bin/omp/$f" $a) || { echo "bench.sh: $f $a failed" >&2; continue; }
+            awk -v f=$f -v s=$size -v t=$t -v ts=$ts -v tp=$tp \
+                'BEGIN { printf "%s,%s,omp,%d,%s,%.3f,%.3f\n", f, s, t, tp, ts / tp, ts / tp / t }'
+        done
+    done
+done
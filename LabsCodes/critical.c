@@ -1,24 +1,123 @@
 #include <omp.h>
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+   Usage: critical [-k buckets] [-m mode]
+
+   Scattered accumulation x[index[i]] += sqrt(work[i]^3), with
+   index[i] = i % BUCKETS, N (no two updates of the same element in an
+   iteration) by default.  Fewer buckets give more conflicts.
+
+   The update is timed with each of
+
+     critical   the original critical section around every update
+     atomic     an atomic update
+     private    a private copy of x per thread, summed at the end of
+                every iteration by a tree over the threads
+     sort       the updates grouped by index once, by a counting sort,
+                so that each element is updated by one thread only
+
+   and the fastest is reported.  The results are compared to a serial
+   run: sort adds in the same order, so it matches exactly, atomic and
+   critical only when no element gets two updates in an iteration, and
+   private, which rounds the sums of each thread to float before adding
+   them to x, differs in the last bits.
+
+   With -m only MODE is run, and without the serial run, so that the
+   run time of the program is that of the one update (bench.sh).
+*/
 
 #define N 10000
+#define ITER 100
+
+typedef void (*update_fn)(int k, int index[], int work[], float x[]);
 
-int main()
+void update_critical(int k, int index[], int work[], float x[]);
+void update_atomic(int k, int index[], int work[], float x[]);
+void update_private(int k, int index[], int work[], float x[]);
+void update_sort(int k, int index[], int work[], float x[]);
+
+int main(int argc, char *argv[])
 {
-    int index[N], it, i, work[N];
-    float x[N];
-    
+    int index[N], it, i, m, opt, work[N], k = N, best;
+    float x[N], ref[N];
+    double t[4], diff, d;
+    char *name[4] = {"critical", "atomic", "private", "sort"};
+    char *mode = NULL;
+    update_fn update[4] = {update_critical, update_atomic, update_private, update_sort};
+
+    while ((opt = getopt(argc, argv, "k:m:")) != -1) {
+        if (opt == 'k')
+            k = atoi(optarg);
+        else if (opt == 'm')
+            mode = optarg;
+        else
+            k = 0;
+    }
+    for (m=0;mode != NULL && m<4;m++)
+        if (strcmp(mode, name[m]) == 0)
+            break;
+    if (k < 1 || k > N || m == 4) {
+        fprintf(stderr, "usage: %s [-k buckets] [-m critical|atomic|private|sort], 1 <= buckets <= %d\n", argv[0], N);
+        return 1;
+    }
 
     for(i=0;i<N;i++)
     {
-    
+
         work[i]=i;
-        index[i]=i%N;
-        x[i]=(float)i;
+        index[i]=i%k;
+        ref[i]=(float)i;
     }
 
-    for (it=0;it<100;it++)
+    if (mode == NULL)
+        for (it=0;it<ITER;it++)
+            for(i=0;i<N;i++)
+                ref[index[i]]=ref[index[i]]+sqrt(pow(work[i],3));
+
+    printf("%d updates of %d elements, %d threads\n", N, k, omp_get_max_threads());
+    best = 0;
+    for (m=0;m<4;m++)
+    {
+        if (mode != NULL && strcmp(mode, name[m]) != 0)
+            continue;
+        for(i=0;i<N;i++)
+            x[i]=(float)i;
+
+        t[m] = omp_get_wtime();
+        update[m](k, index, work, x);
+        t[m] = omp_get_wtime() - t[m];
+        if (mode != NULL) {
+            printf("%-8s %10.6f s\n", name[m], t[m]);
+            return 0;
+        }
+
+        diff = 0.0;
+        for(i=0;i<k;i++){
+            d = fabs(x[i]-ref[i])/fabs(ref[i] != 0.0 ? ref[i] : 1.0);
+            if (d > diff)
+                diff = d;
+        }
+        printf("%-8s %10.6f s  max rel diff %.2e\n", name[m], t[m], diff);
+        if (t[m] < t[best])
+            best = m;
+    }
+    printf("fastest: %s, %.1fx the critical section\n", name[best], t[0] / t[best]);
+    printf("%f, %f\n", ref[6],ref[100]);
+    return 0;
+}
+
+void update_critical(int k, int index[], int work[], float x[])
+{
+    int it, i;
+
+    (void) k;	/* only the private and sort updates need it */
+
+    for (it=0;it<ITER;it++)
     {
 #pragma omp parallel for private(i)
         for(i=0;i<N;i++){
@@ -26,5 +125,99 @@ int main()
             x[index[i]]=x[index[i]]+sqrt(pow(work[i],3));
     }
     }
-    printf("%f, %f\n", x[6],x[100]);
+}
+
+void update_atomic(int k, int index[], int work[], float x[])
+{
+    int it, i;
+
+    (void) k;	/* only the private and sort updates need it */
+
+    for (it=0;it<ITER;it++)
+    {
+#pragma omp parallel for private(i)
+        for(i=0;i<N;i++){
+#pragma omp atomic
+            x[index[i]]+=sqrt(pow(work[i],3));
+    }
+    }
+}
+
+/* Each thread accumulates in its own row of xp; after the loop the rows
+   are summed pairwise in log2(threads) rounds, and row 0 added to x */
+void update_private(int k, int index[], int work[], float x[])
+{
+    int nt;
+    float *xp;
+
+    nt = omp_get_max_threads();
+    xp = malloc(sizeof(float) * nt * k);
+    if (xp == NULL) {
+        fprintf(stderr, "update_private: cannot allocate %d x %d\n", nt, k);
+        exit(1);
+    }
+
+#pragma omp parallel
+    {
+        int it, i, s, id = omp_get_thread_num(), n = omp_get_num_threads();
+        float *mine = xp + (size_t) id * k;
+
+        for (it=0;it<ITER;it++)
+        {
+            for(i=0;i<k;i++)
+                mine[i]=0.0f;
+#pragma omp for
+            for(i=0;i<N;i++)
+                mine[index[i]]=mine[index[i]]+sqrt(pow(work[i],3));
+
+            for (s=1;s<n;s*=2){
+                if (id % (2*s) == 0 && id + s < n)
+                    for(i=0;i<k;i++)
+                        mine[i]+=mine[(size_t) s*k+i];
+#pragma omp barrier
+            }
+
+#pragma omp for
+            for(i=0;i<k;i++)
+                x[i]+=xp[i];
+        }
+    }
+    free(xp);
+}
+
+/* The updates are put in index order once by a counting sort; then each
+   element's updates are applied by one thread, in their original order */
+void update_sort(int k, int index[], int work[], float x[])
+{
+    int it, i, b, *start, *perm;
+
+    start = calloc(k + 1, sizeof(int));
+    perm = malloc(sizeof(int) * N);
+    if (start == NULL || perm == NULL) {
+        fprintf(stderr, "update_sort: cannot allocate the permutation\n");
+        exit(1);
+    }
+    for(i=0;i<N;i++)
+        start[index[i]+1]++;
+    for(b=0;b<k;b++)
+        start[b+1]+=start[b];
+    for(i=0;i<N;i++)
+        perm[start[index[i]]++]=i;
+    for(b=k;b>0;b--)
+        start[b]=start[b-1];
+    start[0]=0;
+
+    for (it=0;it<ITER;it++)
+    {
+#pragma omp parallel for private(b, i) schedule(static)
+        for(b=0;b<k;b++){
+            float s = x[b];
+
+            for(i=start[b];i<start[b+1];i++)
+                s=s+sqrt(pow(work[perm[i]],3));
+            x[b]=s;
+        }
+    }
+    free(start);
+    free(perm);
 }
@@ -0,0 +1,476 @@
+/*
+  gemm.h - cache blocked, OpenMP parallel matrix multiply.
+
+  gemm ( m, n, k, a, lda, b, ldb, c, ldc ) computes C += A*B for the
+  row major M x K matrix A, K x N matrix B and M x N matrix C, with
+  leading dimensions (row lengths) LDA, LDB and LDC.
+
+  The product is organized as in the GotoBLAS/BLIS family:
+
+    for each NC wide panel of columns of B and C        (L3)
+      for each KC deep slice of A and B                 (L2)
+        pack the KC x NC panel of B into NR wide strips
+        pack each MC x KC block of A into MR tall strips
+        for each MC block of A and NR strip of B,       (L2)
+          in parallel
+          for each MR strip of A                        (L1)
+            MR x NR register tile of C += strip A * strip B
+
+  The packed strips are read with unit stride, and the register tile
+  keeps MR*NR partial sums in vector registers for the whole KC loop.
+  Edges are handled by zero padding the packed strips.  The threads
+  share the (block, strip) pairs, so even a few blocks of A keep them
+  all busy.
+
+  gemm_alloc ( n ) returns N doubles aligned to a cache line, or NULL.
+  The multiplies allocate their own work space, and exit if they cannot.
+
+  gemm_serial is the same product on the calling thread, and gemm_tasks
+  a recursive, task parallel one with optional Strassen levels, both
+  described further down.
+
+  Include it in one translation unit; everything is static.
+*/
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+  The register tile is sized to fill the vector register file: 8 x 16
+  doubles in 16 zmm registers with AVX-512 (build with
+  -mprefer-vector-width=512, gcc defaults to ymm), 6 x 8 in 12 ymm
+  otherwise.
+*/
+#if defined(__AVX512F__)
+#ifndef GEMM_MR
+#define GEMM_MR 8		/* rows of the register tile */
+#endif
+#ifndef GEMM_NR
+#define GEMM_NR 16		/* columns of the register tile */
+#endif
+#else
+#ifndef GEMM_MR
+#define GEMM_MR 6
+#endif
+#ifndef GEMM_NR
+#define GEMM_NR 8
+#endif
+#endif
+#ifndef GEMM_MC
+#define GEMM_MC 96		/* rows of a packed block of A */
+#endif
+#ifndef GEMM_KC
+#define GEMM_KC 256		/* depth of the packed blocks */
+#endif
+#ifndef GEMM_NC
+#define GEMM_NC 4096		/* columns of a packed panel of B */
+#endif
+
+#define GEMM_ALIGN 64		/* cache line */
+
+/* Allocate n doubles on a GEMM_ALIGN boundary, release with free(). */
+static double *gemm_alloc(size_t n)
+{
+   void *p;
+
+   if (posix_memalign(&p, GEMM_ALIGN, n * sizeof(double)) != 0)
+      return NULL;
+   return (double *) p;
+}
+
+/* gemm_alloc for the work space of the multiplies, which exit on failure */
+static double *gemm_buffer(size_t n)
+{
+   double *p = gemm_alloc(n);
+
+   if (p == NULL) {
+      fprintf(stderr, "gemm: cannot allocate %zu doubles\n", n);
+      exit(1);
+   }
+   return p;
+}
+
+/* Pack the mc x kc block of A into MR tall strips, p major. */
+static void gemm_pack_a(int mc, int kc, const double *a, int lda, double *ap)
+{
+   int i, ir, p, mr;
+
+   for (ir = 0; ir < mc; ir += GEMM_MR) {
+      mr = mc - ir < GEMM_MR ? mc - ir : GEMM_MR;
+      for (p = 0; p < kc; p++) {
+         for (i = 0; i < mr; i++)
+            ap[i] = a[(size_t) (ir + i) * lda + p];
+         for (; i < GEMM_MR; i++)
+            ap[i] = 0.0;
+         ap += GEMM_MR;
+      }
+   }
+}
+
+/* Pack the kc x nr strip of B, nr <= NR, p major. */
+static void gemm_pack_b(int kc, int nr, const double *b, int ldb, double *bp)
+{
+   int j, p;
+
+   for (p = 0; p < kc; p++) {
+      for (j = 0; j < nr; j++)
+         bp[j] = b[(size_t) p * ldb + j];
+      for (; j < GEMM_NR; j++)
+         bp[j] = 0.0;
+      bp += GEMM_NR;
+   }
+}
+
+/* C[mr][nr] += strip A * strip B, over kc. */
+static void gemm_kernel(int kc, const double *restrict ap,
+                        const double *restrict bp, double *restrict c,
+                        int ldc, int mr, int nr)
+{
+   double t[GEMM_MR][GEMM_NR];
+   int i, j, p;
+
+   memset(t, 0, sizeof(t));
+
+   for (p = 0; p < kc; p++) {
+      for (i = 0; i < GEMM_MR; i++) {
+#pragma omp simd
+         for (j = 0; j < GEMM_NR; j++)
+            t[i][j] += ap[i] * bp[j];
+      }
+      ap += GEMM_MR;
+      bp += GEMM_NR;
+   }
+
+   if (mr == GEMM_MR && nr == GEMM_NR) {
+      for (i = 0; i < GEMM_MR; i++)
+#pragma omp simd
+         for (j = 0; j < GEMM_NR; j++)
+            c[i * ldc + j] += t[i][j];
+   }
+   else {
+      for (i = 0; i < mr; i++)
+         for (j = 0; j < nr; j++)
+            c[i * ldc + j] += t[i][j];
+   }
+}
+
+/* C[mc][nc] += packed block A * packed panel B. */
+static void gemm_macro(int mc, int nc, int kc, const double *ap,
+                       const double *bp, double *c, int ldc)
+{
+   int ir, jr;
+
+   for (jr = 0; jr < nc; jr += GEMM_NR)
+      for (ir = 0; ir < mc; ir += GEMM_MR)
+         gemm_kernel(kc, ap + (size_t) ir * kc, bp + (size_t) jr * kc,
+                     c + (size_t) ir * ldc + jr, ldc,
+                     mc - ir < GEMM_MR ? mc - ir : GEMM_MR,
+                     nc - jr < GEMM_NR ? nc - jr : GEMM_NR);
+}
+
+/* C += A*B, see above. */
+static void gemm(int m, int n, int k, const double *a, int lda,
+                 const double *b, int ldb, double *c, int ldc)
+{
+   double *ap, *bp;
+   int jc, pc, nc, kc, ma;
+
+   if (m <= 0 || n <= 0 || k <= 0)
+      return;
+
+   /* a packed block of A takes ma rows, MC rounded up to MR */
+   ma = (GEMM_MC + GEMM_MR - 1) / GEMM_MR * GEMM_MR;
+   nc = n < GEMM_NC ? n : GEMM_NC;
+   kc = k < GEMM_KC ? k : GEMM_KC;
+   bp = gemm_buffer((size_t) kc * (nc + GEMM_NR));
+   ap = gemm_buffer((size_t) kc * ma * ((m + GEMM_MC - 1) / GEMM_MC));
+
+#pragma omp parallel private(jc, pc)
+   {
+      int ic, jr, mc, kb, nb;
+
+      for (jc = 0; jc < n; jc += GEMM_NC) {
+         nb = n - jc < GEMM_NC ? n - jc : GEMM_NC;
+         for (pc = 0; pc < k; pc += GEMM_KC) {
+            kb = k - pc < GEMM_KC ? k - pc : GEMM_KC;
+
+#pragma omp for schedule(static) nowait
+            for (jr = 0; jr < nb; jr += GEMM_NR)
+               gemm_pack_b(kb, nb - jr < GEMM_NR ? nb - jr : GEMM_NR,
+                           b + (size_t) pc * ldb + jc + jr, ldb,
+                           bp + (size_t) jr * kb);
+
+            /* ends with a barrier, so both are packed */
+#pragma omp for schedule(static)
+            for (ic = 0; ic < m; ic += GEMM_MC)
+               gemm_pack_a(m - ic < GEMM_MC ? m - ic : GEMM_MC, kb,
+                           a + (size_t) ic * lda + pc, lda,
+                           ap + (size_t) (ic / GEMM_MC) * ma * kb);
+
+            /*
+               Static, so that each thread keeps updating the same tiles
+               of C in every slice; consecutive pairs share the block of
+               A, which stays in the L2 cache of the thread.
+            */
+#pragma omp for collapse(2) schedule(static)
+            for (ic = 0; ic < m; ic += GEMM_MC)
+               for (jr = 0; jr < nb; jr += GEMM_NR) {
+                  mc = m - ic < GEMM_MC ? m - ic : GEMM_MC;
+                  gemm_macro(mc, nb - jr < GEMM_NR ? nb - jr : GEMM_NR, kb,
+                             ap + (size_t) (ic / GEMM_MC) * ma * kb,
+                             bp + (size_t) jr * kb,
+                             c + (size_t) ic * ldc + jc + jr, ldc);
+               }
+            /* the implicit barrier keeps ap and bp until every pair is done */
+         }
+      }
+   }
+   free(ap);
+   free(bp);
+}
+
+/* C += A*B on the calling thread only, with the same blocking. */
+static void gemm_serial(int m, int n, int k, const double *a, int lda,
+                        const double *b, int ldb, double *c, int ldc)
+{
+   double *ap, *bp;
+   int ic, jc, jr, pc, mc, nc, kc, kb, nb;
+
+   if (m <= 0 || n <= 0 || k <= 0)
+      return;
+
+   nc = n < GEMM_NC ? n : GEMM_NC;
+   kc = k < GEMM_KC ? k : GEMM_KC;
+   bp = gemm_buffer((size_t) kc * (nc + GEMM_NR));
+   ap = gemm_buffer((size_t) GEMM_MC * kc + GEMM_MR * kc);
+
+   for (jc = 0; jc < n; jc += GEMM_NC) {
+      nb = n - jc < GEMM_NC ? n - jc : GEMM_NC;
+      for (pc = 0; pc < k; pc += GEMM_KC) {
+         kb = k - pc < GEMM_KC ? k - pc : GEMM_KC;
+         for (jr = 0; jr < nb; jr += GEMM_NR)
+            gemm_pack_b(kb, nb - jr < GEMM_NR ? nb - jr : GEMM_NR,
+                        b + (size_t) pc * ldb + jc + jr, ldb,
+                        bp + (size_t) jr * kb);
+         for (ic = 0; ic < m; ic += GEMM_MC) {
+            mc = m - ic < GEMM_MC ? m - ic : GEMM_MC;
+            gemm_pack_a(mc, kb, a + (size_t) ic * lda + pc, lda, ap);
+            gemm_macro(mc, nb, kb, ap, bp, c + (size_t) ic * ldc + jc, ldc);
+         }
+      }
+   }
+   free(ap);
+   free(bp);
+}
+
+/*
+  Recursive multiply.
+
+  gemm_tasks ( m, n, k, a, lda, b, ldb, c, ldc, levels ) computes the
+  same C += A*B by halving the largest of M, N and K until the blocks
+  are below GEMM_LEAF^3 multiply-adds, and multiplying those with
+  gemm_serial.  Halves of M or N update disjoint parts of C and run as
+  OpenMP tasks; halves of K update the same C and run one after the
+  other.  The recursion is cache oblivious, and the tasks balance the
+  load over threads of different speeds.
+
+  The first LEVELS recursions of blocks at least GEMM_STRASSEN_MIN on
+  every side, and even, use Strassen's 7 multiplications instead of 8.
+  Each level allocates 7 quarter products plus the operand sums, and
+  rounds differently from the classical product.
+*/
+#ifndef GEMM_LEAF
+#define GEMM_LEAF 256		/* cube root of the leaf size */
+#endif
+#ifndef GEMM_STRASSEN_MIN
+#define GEMM_STRASSEN_MIN 1024	/* smallest side for a Strassen level */
+#endif
+
+static void gemm_rec(int m, int n, int k, const double *a, int lda,
+                     const double *b, int ldb, double *c, int ldc,
+                     int levels);
+
+/* Z = X + s*Y for m x n matrices. */
+static void gemm_add(int m, int n, const double *x, int ldx, double s,
+                     const double *y, int ldy, double *z, int ldz)
+{
+   int i, j;
+
+   for (i = 0; i < m; i++)
+#pragma omp simd
+      for (j = 0; j < n; j++)
+         z[(size_t) i * ldz + j] = x[(size_t) i * ldx + j]
+                                   + s * y[(size_t) i * ldy + j];
+}
+
+/* M = (A1 + sa*A2) * (B1 + sb*B2), with A2 or B2 NULL for none. */
+static void gemm_strassen_product(int m, int n, int k,
+                                  const double *a1, double sa,
+                                  const double *a2, int lda,
+                                  const double *b1, double sb,
+                                  const double *b2, int ldb,
+                                  double *mp, int levels)
+{
+   const double *x = a1, *y = b1;
+   double *ta = NULL, *tb = NULL;
+   int ldx = lda, ldy = ldb;
+
+   if (a2 != NULL) {
+      ta = gemm_buffer((size_t) m * k);
+      gemm_add(m, k, a1, lda, sa, a2, lda, ta, k);
+      x = ta;
+      ldx = k;
+   }
+   if (b2 != NULL) {
+      tb = gemm_buffer((size_t) k * n);
+      gemm_add(k, n, b1, ldb, sb, b2, ldb, tb, n);
+      y = tb;
+      ldy = n;
+   }
+
+   memset(mp, 0, (size_t) m * n * sizeof(double));
+   gemm_rec(m, n, k, x, ldx, y, ldy, mp, n, levels);
+
+   free(ta);
+   free(tb);
+}
+
+/* C += A*B with one level of Strassen, M, N and K even. */
+static void gemm_strassen(int m, int n, int k, const double *a, int lda,
+                          const double *b, int ldb, double *c, int ldc,
+                          int levels)
+{
+   const double *a11, *a12, *a21, *a22, *b11, *b12, *b21, *b22;
+   double *c11, *c12, *c21, *c22, *mp[7];
+   int i, j, m2 = m / 2, n2 = n / 2, k2 = k / 2;
+   size_t q = (size_t) m2 * n2;
+
+   a11 = a;
+   a12 = a + k2;
+   a21 = a + (size_t) m2 * lda;
+   a22 = a21 + k2;
+   b11 = b;
+   b12 = b + n2;
+   b21 = b + (size_t) k2 * ldb;
+   b22 = b21 + n2;
+   c11 = c;
+   c12 = c + n2;
+   c21 = c + (size_t) m2 * ldc;
+   c22 = c21 + n2;
+
+   for (i = 0; i < 7; i++)
+      mp[i] = gemm_buffer(q);
+
+#pragma omp task
+   gemm_strassen_product(m2, n2, k2, a11, 1.0, a22, lda,
+                         b11, 1.0, b22, ldb, mp[0], levels);
+#pragma omp task
+   gemm_strassen_product(m2, n2, k2, a21, 1.0, a22, lda,
+                         b11, 0.0, NULL, ldb, mp[1], levels);
+#pragma omp task
+   gemm_strassen_product(m2, n2, k2, a11, 0.0, NULL, lda,
+                         b12, -1.0, b22, ldb, mp[2], levels);
+#pragma omp task
+   gemm_strassen_product(m2, n2, k2, a22, 0.0, NULL, lda,
+                         b21, -1.0, b11, ldb, mp[3], levels);
+#pragma omp task
+   gemm_strassen_product(m2, n2, k2, a11, 1.0, a12, lda,
+                         b22, 0.0, NULL, ldb, mp[4], levels);
+#pragma omp task
+   gemm_strassen_product(m2, n2, k2, a21, -1.0, a11, lda,
+                         b11, 1.0, b12, ldb, mp[5], levels);
+#pragma omp task
+   gemm_strassen_product(m2, n2, k2, a12, -1.0, a22, lda,
+                         b21, 1.0, b22, ldb, mp[6], levels);
+#pragma omp taskwait
+
+   /*
+      C11 += M1 + M4 - M5 + M7    C12 += M3 + M5
+      C21 += M2 + M4              C22 += M1 - M2 + M3 + M6
+   */
+#pragma omp task private(j)
+   for (i = 0; i < m2; i++)
+#pragma omp simd
+      for (j = 0; j < n2; j++)
+         c11[(size_t) i * ldc + j] += mp[0][i * n2 + j] + mp[3][i * n2 + j]
+                                      - mp[4][i * n2 + j] + mp[6][i * n2 + j];
+#pragma omp task private(j)
+   for (i = 0; i < m2; i++)
+#pragma omp simd
+      for (j = 0; j < n2; j++)
+         c12[(size_t) i * ldc + j] += mp[2][i * n2 + j] + mp[4][i * n2 + j];
+#pragma omp task private(j)
+   for (i = 0; i < m2; i++)
+#pragma omp simd
+      for (j = 0; j < n2; j++)
+         c21[(size_t) i * ldc + j] += mp[1][i * n2 + j] + mp[3][i * n2 + j];
+#pragma omp task private(j)
+   for (i = 0; i < m2; i++)
+#pragma omp simd
+      for (j = 0; j < n2; j++)
+         c22[(size_t) i * ldc + j] += mp[0][i * n2 + j] - mp[1][i * n2 + j]
+                                      + mp[2][i * n2 + j] + mp[5][i * n2 + j];
+#pragma omp taskwait
+
+   for (i = 0; i < 7; i++)
+      free(mp[i]);
+}
+
+static void gemm_rec(int m, int n, int k, const double *a, int lda,
+                     const double *b, int ldb, double *c, int ldc,
+                     int levels)
+{
+   int h;
+
+   if (levels > 0 && m % 2 == 0 && n % 2 == 0 && k % 2 == 0
+       && m >= GEMM_STRASSEN_MIN && n >= GEMM_STRASSEN_MIN
+       && k >= GEMM_STRASSEN_MIN) {
+      gemm_strassen(m, n, k, a, lda, b, ldb, c, ldc, levels - 1);
+   }
+   else if ((double) m * n * k
+            <= (double) GEMM_LEAF * GEMM_LEAF * GEMM_LEAF) {
+      gemm_serial(m, n, k, a, lda, b, ldb, c, ldc);
+   }
+   else if (m >= n && m >= k) {
+      /* round the split to whole register tiles */
+      h = (m / 2 + GEMM_MR - 1) / GEMM_MR * GEMM_MR;
+#pragma omp task
+      gemm_rec(h, n, k, a, lda, b, ldb, c, ldc, levels);
+#pragma omp task
+      gemm_rec(m - h, n, k, a + (size_t) h * lda, lda, b, ldb,
+               c + (size_t) h * ldc, ldc, levels);
+#pragma omp taskwait
+   }
+   else if (n >= k) {
+      h = (n / 2 + GEMM_NR - 1) / GEMM_NR * GEMM_NR;
+#pragma omp task
+      gemm_rec(m, h, k, a, lda, b, ldb, c, ldc, levels);
+#pragma omp task
+      gemm_rec(m, n - h, k, a, lda, b + h, ldb, c + h, ldc, levels);
+#pragma omp taskwait
+   }
+   else {
+      h = k / 2;
+      gemm_rec(m, n, h, a, lda, b, ldb, c, ldc, levels);
+      gemm_rec(m, n, k - h, a + h, lda, b + (size_t) h * ldb, ldb,
+               c, ldc, levels);
+   }
+}
+
+/* C += A*B by recursion over OpenMP tasks, see above. */
+static void gemm_tasks(int m, int n, int k, const double *a, int lda,
+                       const double *b, int ldb, double *c, int ldc,
+                       int levels)
+{
+   if (m <= 0 || n <= 0 || k <= 0)
+      return;
+
+#pragma omp parallel
+#pragma omp single
+   gemm_rec(m, n, k, a, lda, b, ldb, c, ldc, levels);
+}
+
+#endif
@@ -16,31 +16,91 @@
 *          relax - Successice over relaxation parameter
 *          mits  - Maximum iterations for iterative solver
 *
+* Usage :  jacobi [-n n] [-m m] [-s jacobi|sor|tiled] [-i mits] [-w omega]
+*                 [-k sweeps] [-l every]
+*          -n and -m set the grid size, 1000 x 1000 by default,
+*          -s selects the solver, Jacobi (default), red-black SOR or
+*          temporally blocked Jacobi, which does -k sweeps (8) per tile
+*          and checks the residual every -k sweeps,
+*          -i overrides mits, -w the relaxation factor of the solver,
+*          -l prints the residual every so many iterations.
+*
+*          The grids are cache line aligned heap arrays, first touched
+*          by static parallel loops over rows, so that their pages are
+*          placed near the threads that sweep them.
+*
 * On output 
 *       : u(n,m) - Dependent variable (solutions)
 *       : f(n,m) - Right hand side function 
 *************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <math.h>
+#include "prof.h"
 
-#define m 1000
-#define n 1000
+#define M 1000	/* default grid size */
+#define N 1000
 #define mits 300
 #define tol 0.0000000001
 #define alpha 0.0
 #define relax 0.1
 #define PI  3.1415926
+#define TILE_BYTES (1 << 20)	/* cache budget of a tile of jacobi_tiled */
 
-void initialize(int l, int t, double al, double *dx, double *dy, double u[n][m], double f[n][m]);
-void jacobi(int l, int t, double dx, double dy, double al, double omega, double u[n][m], double f[n][m], double uold[n][m],double tolerance, double maxits);
-void error_check(int l, int t, double al, double *dx, double *dy, double u[][m], double f[][m]);
+int log_every = 0;	/* iterations between residual log lines, 0 for none */
 
-int main()
+double *alloc_grid(int l, int t);
+void log_residual(int k, double error);
+void initialize(int l, int t, double al, double *dx, double *dy, double u[l][t], double f[l][t]);
+void jacobi(int l, int t, double dx, double dy, double al, double omega, double u[l][t], double f[l][t], double uold[l][t],double tolerance, double maxits);
+void jacobi_tiled(int l, int t, double dx, double dy, double al, double omega, double u[l][t], double f[l][t], double uold[l][t],double tolerance, double maxits, int sweeps);
+void sor(int l, int t, double dx, double dy, double al, double omega, double u[l][t], double f[l][t], double tolerance, double maxits);
+double sor_omega(int l, int t, double dx, double dy, double al);
+void error_check(int l, int t, double al, double *dx, double *dy, double u[l][t], double f[l][t]);
+
+int main(int argc, char *argv[])
 {
     
-    double u[n][m],f[n][m],dx,dy;
-    double uold[n][m];
+    int n = N, m = M;
+    double dx,dy;
+    int opt, solver = 0, sweeps = 8;
+    double maxits = mits, omega = 0.0;
+
+    while ((opt = getopt(argc, argv, "n:m:s:i:w:k:l:")) != -1) {
+        if (opt == 'n')
+            n = atoi(optarg);
+        else if (opt == 'm')
+            m = atoi(optarg);
+        else if (opt == 'l')
+            log_every = atoi(optarg);
+        else if (opt == 's' && strcmp(optarg, "jacobi") == 0)
+            solver = 0;
+        else if (opt == 's' && strcmp(optarg, "sor") == 0)
+            solver = 1;
+        else if (opt == 's' && strcmp(optarg, "tiled") == 0)
+            solver = 2;
+        else if (opt == 'i')
+            maxits = atoi(optarg);
+        else if (opt == 'w')
+            omega = atof(optarg);
+        else if (opt == 'k' && atoi(optarg) > 0)
+            sweeps = atoi(optarg);
+        else {
+            opt = -1;
+            break;
+        }
+    }
+    if (opt != -1 || n < 3 || m < 3) {
+        fprintf(stderr, "usage: %s [-n n] [-m m] [-s jacobi|sor|tiled] [-i mits] [-w omega] [-k sweeps] [-l every]\n", argv[0]);
+        return 1;
+    }
+
+    double (*u)[m] = (double (*)[m]) alloc_grid(n,m);
+    double (*f)[m] = (double (*)[m]) alloc_grid(n,m);
+    double (*uold)[m] = (double (*)[m]) alloc_grid(n,m);
 
 /* Initialize data*/
 
@@ -48,15 +108,62 @@ int main()
 
 /* Solve Helmholtz equation*/
 
-    jacobi (n,m,dx,dy,alpha,relax,u,f,uold,tol,mits);
+    if (solver == 1) {
+        if (omega == 0.0)
+            omega = sor_omega(n,m,dx,dy,alpha);
+        printf("Red-black SOR, omega=%f\n", omega);
+        sor (n,m,dx,dy,alpha,omega,u,f,tol,maxits);
+    }
+    else if (solver == 2) {
+        if (omega == 0.0)
+            omega = relax;
+        printf("Temporally blocked Jacobi, %d sweeps per tile\n", sweeps);
+        jacobi_tiled (n,m,dx,dy,alpha,omega,u,f,uold,tol,maxits,sweeps);
+    }
+    else {
+        if (omega == 0.0)
+            omega = relax;
+        jacobi (n,m,dx,dy,alpha,omega,u,f,uold,tol,maxits);
+    }
 
 /* Check error between exact solution*/
 
     error_check (n,m,alpha,&dx,&dy,u,f);
 
+    free(u);
+    free(f);
+    free(uold);
+    return 0;
+}
+
+double *alloc_grid(int l, int t)
+{
+/******************************************************
+* Allocates an l x t grid on a cache line boundary,
+* without touching its pages
+******************************************************/
+
+    void *p;
+
+    if (posix_memalign(&p, 64, sizeof(double)*l*t) != 0) {
+        fprintf(stderr, "Cannot allocate a %d x %d grid\n", l, t);
+        exit(1);
+    }
+    return (double *) p;
+}
+
+void log_residual(int k, double error)
+{
+/******************************************************
+* Prints the residual after k iterations, every
+* log_every iterations
+******************************************************/
+
+    if (log_every > 0 && k % log_every == 0)
+        printf("Iteration %d Residual=%E\n", k, error);
 }
 
-void initialize(int l, int t, double al, double *dx, double *dy, double u[n][m], double f[n][m])
+void initialize(int l, int t, double al, double *dx, double *dy, double u[l][t], double f[l][t])
 {
 /******************************************************
 * Initializes data 
@@ -64,13 +171,15 @@ void initialize(int l, int t, double al, double *dx, double *dy, double u[n][m],
 *
 ******************************************************/
   
-    int i,j, xx,yy;
+    int i,j;
+    double xx,yy;
 
     *dx = 2.0 / (l-1);
     *dy = 2.0 / (t-1);
     
 /* Initilize initial condition and RHS*/
 
+#pragma omp parallel for private(j,xx,yy) schedule(static)
     for(i=0;i<l;i++)
         for(j=0;j<t;j++){
             xx = -1.0 + (*dx) * (double)(i-1);        /* -1 < x < 1*/
@@ -80,7 +189,7 @@ void initialize(int l, int t, double al, double *dx, double *dy, double u[n][m],
     
 }
 
-void jacobi(int l, int t, double dx, double dy, double al, double omega, double u[n][m], double f[n][m], double uold[n][m],double tolerance, double maxits){
+void jacobi(int l, int t, double dx, double dy, double al, double omega, double u[l][t], double f[l][t], double uold[l][t],double tolerance, double maxits){
 /******************************************************************
 * Subroutine HelmholtzJ
 * Solves poisson equation on rectangular grid assuming : 
@@ -99,48 +208,86 @@ void jacobi(int l, int t, double dx, double dy, double al, double omega, double
 *         maxit  Maximum number of iterations 
 *
 * Output : u(n,m) - Solution 
+*
+* With log_every set, the residual is printed every log_every
+* iterations.  With -DPROF each thread's time in the sweeps is
+* region "jacobi.sweep", and its wait for the others "jacobi.barrier".
 *****************************************************************/
 
     int i,j,k;
-    double error,resid,ax,ay,b;
+    double error,resid,ax,ay,b,sum;
+    double (*un)[t], (*uo)[t], (*tmp)[t];
 
 /*
 * Initialize coefficients */
     ax = 1.0/(dx*dx);  // X-direction coef
     ay = 1.0/(dy*dy); // Y-direction coef
-    b  = -2.0/(dx*dx)-2.0/(dy*dy)-alpha;  // Central coeff
+    b  = -2.0/(dx*dx)-2.0/(dy*dy)-al;  // Central coeff
 
     error = 10.0*tol;
     k = 1;
+    sum = 0.0;
 
-    while (k <= maxits && error > tolerance)
-    {
-
-        error = (double)0.0  ;
+/*
+* u and uold are used as two buffers: each sweep reads uo and writes
+* un, then the pointers are swapped, so the solution is never copied.
+* The boundary, which is never written, is copied into uold once.
+*
+* One parallel region covers all the sweeps.  Every thread tests the
+* loop condition on the shared k and error, which only change in the
+* single construct at the end of a sweep, behind its barrier.
+*/
+    uo = u;
+    un = uold;
 
-/* Copy new solution into old*/
-        
-        for(i=0;i<l;i++)
-            for(j=0;j<t;j++)
-                uold[i][j] = u[i][j];
+#pragma omp parallel private(i,j,resid)
+    {
+#pragma omp for
+    for(i=0;i<l;i++)
+        for(j=0;j<t;j++)
+            uold[i][j] = u[i][j];
 
+    while (k <= maxits && error > tolerance)
+    {
 /* Compute stencil, residual, & update*/
 
+        PROF_BEGIN("jacobi.sweep");
+#pragma omp for reduction(+:sum) nowait
         for(i=1;i<l-1;i++)
             for(j=1;j<t-1;j++){
          
 /*     Evaluate residual */
-                resid = (ax*(uold[i-1][j] + uold[i+1][j]) + ay*(uold[i][j-1] + uold[i][j+1])+ b * uold[i][j] - f[i][j])/b;
+                resid = (ax*(uo[i-1][j] + uo[i+1][j]) + ay*(uo[i][j-1] + uo[i][j+1])+ b * uo[i][j] - f[i][j])/b;
 /* Update solution */
-                u[i][j] = uold[i][j] - omega * resid;
+                un[i][j] = uo[i][j] - omega * resid;
 /* Accumulate residual error*/
-                error = error + resid*resid;}
+                sum = sum + resid*resid;}
+        PROF_END("jacobi.sweep");
+        PROF_BARRIER("jacobi.barrier");
             
 /* Error check */
         
+#pragma omp single
+        {
         k = k + 1;
 
-        error = (double)sqrt(error)/(double)(l*t);
+        error = (double)sqrt(sum)/(double)(l*t);
+        log_residual(k-1, error);
+        sum = 0.0;
+        tmp = un;
+        un = uo;
+        uo = tmp;
+        }
+    }
+    }
+
+/* The last sweep may have written uold */
+
+    if (uo != u) {
+#pragma omp parallel for private(j)
+        for(i=1;i<l-1;i++)
+            for(j=1;j<t-1;j++)
+                u[i][j] = uo[i][j];
     }
     
     printf("Total Number of Iterations=%d\n", k);
@@ -148,7 +295,205 @@ void jacobi(int l, int t, double dx, double dy, double al, double omega, double
 
   }
 
-void error_check(int l, int t, double al, double *dx, double *dy, double u[][m], double f[][m]){
+void jacobi_tiled(int l, int t, double dx, double dy, double al, double omega, double u[l][t], double f[l][t], double uold[l][t],double tolerance, double maxits, int sweeps){
+/******************************************************************
+* The Jacobi iteration of jacobi(), temporally blocked.
+*
+* The interior rows are cut into tiles of nt rows, sized so that two
+* copies of a tile and its halo fit in TILE_BYTES of cache.  Each
+* thread loads a tile with `sweeps' extra rows on either side (the
+* ghost zone) into a private buffer, does the sweeps there, and
+* writes back the tile rows.  Sweep s can update all but the outer s
+* rows of the ghost zone, except at the physical boundary, which is
+* fixed, so after the last sweep the tile rows are exact: u is the same
+* as after as many plain sweeps, for (nt+sweeps)/nt times the stencil
+* work but 1/sweeps of the memory traffic.
+*
+* The residual is that of the last sweep of a block, so the tolerance
+* is only checked every `sweeps' sweeps.
+*****************************************************************/
+
+    int i,j,k,nt;
+    double error,resid,ax,ay,b,sum;
+    double (*un)[t], (*uo)[t], (*tmp)[t];
+
+/*
+* Initialize coefficients */
+    ax = 1.0/(dx*dx);  // X-direction coef
+    ay = 1.0/(dy*dy); // Y-direction coef
+    b  = -2.0/(dx*dx)-2.0/(dy*dy)-al;  // Central coeff
+
+    nt = (int) (TILE_BYTES/(2*sizeof(double)*t)) - 2*sweeps;
+    if (nt < 4*sweeps)
+        nt = 4*sweeps;	/* bound the redundant ghost zone work */
+
+    error = 10.0*tol;
+    k = 1;
+    sum = 0.0;
+    uo = u;
+    un = uold;
+
+#pragma omp parallel private(i,j,resid)
+    {
+    int i0,i1,lo,hi,g,glo,ghi,s,ks;
+    double (*a)[t] = malloc(sizeof(double)*(nt+2*sweeps)*t);
+    double (*c)[t] = malloc(sizeof(double)*(nt+2*sweeps)*t);
+    double (*w)[t];
+
+    if (a == NULL || c == NULL) {
+        fprintf(stderr, "Cannot allocate a %d x %d tile\n", nt+2*sweeps, t);
+        exit(1);
+    }
+
+#pragma omp for
+    for(i=0;i<l;i++)
+        for(j=0;j<t;j++)
+            uold[i][j] = u[i][j];
+
+    while (k <= maxits && error > tolerance)
+    {
+        ks = maxits - k + 1 < sweeps ? maxits - k + 1 : sweeps;
+
+#pragma omp for reduction(+:sum) schedule(static)
+        for(i0=1;i0<l-1;i0+=nt){
+            i1 = i0+nt < l-1 ? i0+nt : l-1;
+            lo = i0-ks > 0 ? i0-ks : 0;
+            hi = i1+ks < l ? i1+ks : l;
+
+/* Load the tile and its ghost zone, rows lo..hi-1 */
+            memcpy(a, uo[lo], sizeof(double)*(hi-lo)*t);
+/* The second buffer only needs the fixed boundary */
+            for(i=0;i<hi-lo;i++){
+                c[i][0] = a[i][0];
+                c[i][t-1] = a[i][t-1];}
+            if (lo == 0)
+                memcpy(c[0], a[0], sizeof(double)*t);
+            if (hi == l)
+                memcpy(c[hi-lo-1], a[hi-lo-1], sizeof(double)*t);
+
+            for(s=1;s<=ks;s++){
+                glo = lo == 0 ? 1 : lo+s;
+                ghi = hi == l ? l-1 : hi-s;
+                for(g=glo;g<ghi;g++){
+                    i = g-lo;
+                    if (s < ks || g < i0 || g >= i1)
+                        for(j=1;j<t-1;j++){
+                            resid = (ax*(a[i-1][j] + a[i+1][j]) + ay*(a[i][j-1] + a[i][j+1])+ b * a[i][j] - f[g][j])/b;
+                            c[i][j] = a[i][j] - omega * resid;}
+                    else
+/* Last sweep of a tile row, accumulate residual error */
+                        for(j=1;j<t-1;j++){
+                            resid = (ax*(a[i-1][j] + a[i+1][j]) + ay*(a[i][j-1] + a[i][j+1])+ b * a[i][j] - f[g][j])/b;
+                            c[i][j] = a[i][j] - omega * resid;
+                            sum = sum + resid*resid;}
+                }
+                w = a;
+                a = c;
+                c = w;
+            }
+
+/* Write back the tile rows */
+            memcpy(un[i0], a[i0-lo], sizeof(double)*(i1-i0)*t);
+        }
+
+#pragma omp single
+        {
+        k = k + ks;
+
+        error = (double)sqrt(sum)/(double)(l*t);
+        if (log_every > 0 && (k-1)/log_every != (k-1-ks)/log_every)
+            printf("Iteration %d Residual=%E\n", k-1, error);
+        sum = 0.0;
+        tmp = un;
+        un = uo;
+        uo = tmp;
+        }
+    }
+    free(a);
+    free(c);
+    }
+
+/* The last block may have written uold */
+
+    if (uo != u) {
+#pragma omp parallel for private(j)
+        for(i=1;i<l-1;i++)
+            for(j=1;j<t-1;j++)
+                u[i][j] = uo[i][j];
+    }
+    
+    printf("Total Number of Iterations=%d\n", k);
+    printf("Residual=%E\n", error);
+
+}
+
+double sor_omega(int l, int t, double dx, double dy, double al){
+/******************************************************************
+* Optimal SOR relaxation factor 2/(1+sqrt(1-rho^2)), where rho is
+* the spectral radius of the Jacobi iteration on the l x t grid
+*****************************************************************/
+
+    double ax,ay,b,rho;
+
+    ax = 1.0/(dx*dx);
+    ay = 1.0/(dy*dy);
+    b  = -2.0/(dx*dx)-2.0/(dy*dy)-al;
+    rho = -(2.0*ax*cos(PI/(l-1)) + 2.0*ay*cos(PI/(t-1)))/b;
+
+    return 2.0/(1.0+sqrt(1.0-rho*rho));
+}
+
+void sor(int l, int t, double dx, double dy, double al, double omega, double u[l][t], double f[l][t], double tolerance, double maxits){
+/******************************************************************
+* Solves the same equation as jacobi() by red-black successive
+* over relaxation.  The points with i+j even (red) are updated
+* first, from their black neighbours, then the black points from
+* the new red ones.  The points of one color only depend on the
+* other, so each half sweep is a parallel loop over rows, and
+* updating u in place needs no uold copy.
+*
+* With omega near its optimum the number of sweeps grows like n
+* instead of n^2 for Jacobi.
+*
+* The residual is accumulated as in jacobi(), over both colors.
+*****************************************************************/
+
+    int i,j,k,color;
+    double error,resid,ax,ay,b;
+
+    ax = 1.0/(dx*dx);  // X-direction coef
+    ay = 1.0/(dy*dy); // Y-direction coef
+    b  = -2.0/(dx*dx)-2.0/(dy*dy)-al;  // Central coeff
+
+    error = 10.0*tol;
+    k = 1;
+
+    while (k <= maxits && error > tolerance)
+    {
+
+        error = (double)0.0  ;
+
+        for(color=0;color<2;color++){
+#pragma omp parallel for private(j,resid) reduction(+:error)
+            for(i=1;i<l-1;i++)
+                for(j=1+(i+1+color)%2;j<t-1;j+=2){
+                    resid = (ax*(u[i-1][j] + u[i+1][j]) + ay*(u[i][j-1] + u[i][j+1])+ b * u[i][j] - f[i][j])/b;
+                    u[i][j] = u[i][j] - omega * resid;
+                    error = error + resid*resid;}
+        }
+
+        k = k + 1;
+
+        error = (double)sqrt(error)/(double)(l*t);
+        log_residual(k-1, error);
+    }
+    
+    printf("Total Number of Iterations=%d\n", k);
+    printf("Residual=%E\n", error);
+
+}
+
+void error_check(int l, int t, double al, double *dx, double *dy, double u[l][t], double f[l][t]){
 /************************************************************
 * Checks error between numerical and exact solution 
 *
@@ -0,0 +1,300 @@
+/************************************************************
+* program to solve a finite difference
+* discretization of Helmholtz equation :
+* (d2/dx2)u + (d2/dy2)u - alpha u = f
+* using Jacobi iterative method, distributed with MPI over
+* blocks of rows and parallelized with OpenMP within each rank.
+*
+* Hybrid version of jacobi.c.
+*
+* Input :  n - grid dimension in x direction
+*          m - grid dimension in y direction
+*          alpha - Helmholtz constant (always greater than 0.0)
+*          tol   - error tolerance for iterative solver
+*          relax - Successice over relaxation parameter
+*          mits  - Maximum iterations for iterative solver
+*
+* Usage :  mpirun -np P jacobi_mpi [-n n] [-m m] [-i mits] [-w omega]
+*                 [-l every]
+*          -n and -m set the grid size, 1000 x 1000 by default,
+*          -i overrides mits, -w the relaxation factor,
+*          -l prints the residual every so many iterations.
+*
+*          Rank r owns a block of about n/P consecutive rows, stored
+*          with one ghost row above and below.  Each sweep sends its
+*          first and last rows to the neighbouring ranks without
+*          blocking, updates the rows that do not need the ghost rows
+*          while the messages are in flight, then waits for them and
+*          updates the two edge rows.  The residual is summed over the
+*          ranks with MPI_Allreduce.
+*
+*          MPI is only called outside the OpenMP parallel regions
+*          (MPI_THREAD_FUNNELED).
+*
+* On output
+*       : u(n,m) - Dependent variable (solutions)
+*       : f(n,m) - Right hand side function
+*************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <mpi.h>
+
+#define M 1000	/* default grid size */
+#define N 1000
+#define mits 300
+#define tol 0.0000000001
+#define alpha 0.0
+#define relax 0.1
+#define PI  3.1415926
+
+int log_every = 0;	/* iterations between residual log lines, 0 for none */
+int rank, nranks;	/* this rank and the number of ranks */
+int up, down;		/* the neighbouring ranks, or MPI_PROC_NULL */
+
+double *alloc_grid(int l, int t);
+void initialize(int l, int t, int g0, int n, double al, double *dx, double *dy, double u[l+2][t], double f[l+2][t]);
+void jacobi(int l, int t, int g0, int n, double dx, double dy, double al, double omega, double u[l+2][t], double f[l+2][t], double uold[l+2][t], double tolerance, double maxits);
+void error_check(int l, int t, int g0, int n, double *dx, double *dy, double u[l+2][t]);
+
+int main(int argc, char *argv[])
+{
+
+    int n = N, m = M;
+    int opt, provided, nl, g0;
+    double dx,dy;
+    double maxits = mits, omega = relax;
+
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &nranks);
+
+    while ((opt = getopt(argc, argv, "n:m:i:w:l:")) != -1) {
+        if (opt == 'n')
+            n = atoi(optarg);
+        else if (opt == 'm')
+            m = atoi(optarg);
+        else if (opt == 'i')
+            maxits = atoi(optarg);
+        else if (opt == 'w')
+            omega = atof(optarg);
+        else if (opt == 'l')
+            log_every = atoi(optarg);
+        else {
+            opt = -1;
+            break;
+        }
+    }
+    if (opt != -1 || m < 3 || n < nranks) {
+        if (rank == 0)
+            fprintf(stderr, "usage: %s [-n n] [-m m] [-i mits] [-w omega] [-l every]\n", argv[0]);
+        MPI_Finalize();
+        return 1;
+    }
+
+/* Rows g0 .. g0+nl-1 of the grid are local rows 1 .. nl */
+
+    nl = n / nranks + (rank < n % nranks);
+    g0 = rank * (n / nranks) + (rank < n % nranks ? rank : n % nranks);
+    up = rank > 0 ? rank - 1 : MPI_PROC_NULL;
+    down = rank < nranks - 1 ? rank + 1 : MPI_PROC_NULL;
+
+    double (*u)[m] = (double (*)[m]) alloc_grid(nl+2,m);
+    double (*f)[m] = (double (*)[m]) alloc_grid(nl+2,m);
+    double (*uold)[m] = (double (*)[m]) alloc_grid(nl+2,m);
+
+    if (rank == 0)
+        printf("%d x %d grid on %d ranks\n", n, m, nranks);
+
+/* Initialize data*/
+
+    initialize (nl,m,g0,n,alpha,&dx,&dy,u,f);
+
+/* Solve Helmholtz equation*/
+
+    jacobi (nl,m,g0,n,dx,dy,alpha,omega,u,f,uold,tol,maxits);
+
+/* Check error between exact solution*/
+
+    error_check (nl,m,g0,n,&dx,&dy,u);
+
+    free(u);
+    free(f);
+    free(uold);
+    MPI_Finalize();
+    return 0;
+}
+
+double *alloc_grid(int l, int t)
+{
+/******************************************************
+* Allocates an l x t grid on a cache line boundary,
+* without touching its pages
+******************************************************/
+
+    void *p = NULL;
+
+    if (posix_memalign(&p, 64, sizeof(double)*l*t) != 0) {
+        fprintf(stderr, "Rank %d cannot allocate a %d x %d grid\n", rank, l, t);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    return (double *) p;
+}
+
+void initialize(int l, int t, int g0, int n, double al, double *dx, double *dy, double u[l+2][t], double f[l+2][t])
+{
+/******************************************************
+* Initializes the local rows and the ghost rows
+* Assumes exact solution is u(x,y) = (1-x^2)*(1-y^2)
+*
+******************************************************/
+
+    int i,j;
+    double xx,yy;
+
+    *dx = 2.0 / (n-1);
+    *dy = 2.0 / (t-1);
+
+/* Initilize initial condition and RHS*/
+
+#pragma omp parallel for private(j,xx,yy) schedule(static)
+    for(i=0;i<l+2;i++)
+        for(j=0;j<t;j++){
+            xx = -1.0 + (*dx) * (double)(g0+i-1-1);        /* -1 < x < 1*/
+            yy = -1.0 + (*dy) * (double)(j-1);        /* -1 < y < 1*/
+            u[i][j] = 0.0;
+            f[i][j] = -al *(1.0-xx*xx)*(1.0-yy*yy)-2.0*(1.0-xx*xx)-2.0*(1.0-yy*yy);}
+
+}
+
+void jacobi(int l, int t, int g0, int n, double dx, double dy, double al, double omega, double u[l+2][t], double f[l+2][t], double uold[l+2][t], double tolerance, double maxits){
+/******************************************************************
+* Jacobi iteration of jacobi.c on the local rows 1..l of a block
+* starting at grid row g0 of n, with ghost rows 0 and l+1.
+*
+* u and uold are swapped as the two buffers of the iteration.  The
+* grid boundary rows 0 and n-1 and columns 0 and t-1 stay fixed.
+*****************************************************************/
+
+    int i,j,k,lo,hi;
+    double error,resid,ax,ay,b,sum,gsum;
+    double (*un)[t], (*uo)[t], (*tmp)[t];
+    MPI_Request req[4];
+
+/*
+* Initialize coefficients */
+    ax = 1.0/(dx*dx);  // X-direction coef
+    ay = 1.0/(dy*dy); // Y-direction coef
+    b  = -2.0/(dx*dx)-2.0/(dy*dy)-al;  // Central coeff
+
+/* The local rows to update, without the grid boundary */
+    lo = g0 == 0 ? 2 : 1;
+    hi = g0+l == n ? l-1 : l;
+
+    error = 10.0*tol;
+    k = 1;
+    uo = u;
+    un = uold;
+
+#pragma omp parallel for private(j)
+    for(i=0;i<l+2;i++)
+        for(j=0;j<t;j++)
+            uold[i][j] = u[i][j];
+
+    while (k <= maxits && error > tolerance)
+    {
+        sum = 0.0;
+
+/* Exchange the edge rows with the neighbours */
+
+        MPI_Irecv(uo[0], t, MPI_DOUBLE, up, 0, MPI_COMM_WORLD, &req[0]);
+        MPI_Irecv(uo[l+1], t, MPI_DOUBLE, down, 1, MPI_COMM_WORLD, &req[1]);
+        MPI_Isend(uo[1], t, MPI_DOUBLE, up, 1, MPI_COMM_WORLD, &req[2]);
+        MPI_Isend(uo[l], t, MPI_DOUBLE, down, 0, MPI_COMM_WORLD, &req[3]);
+
+/* Compute stencil, residual, & update of the inner rows meanwhile */
+
+#pragma omp parallel for private(j,resid) reduction(+:sum)
+        for(i=2;i<l;i++)
+            if (i >= lo && i <= hi)
+            for(j=1;j<t-1;j++){
+                resid = (ax*(uo[i-1][j] + uo[i+1][j]) + ay*(uo[i][j-1] + uo[i][j+1])+ b * uo[i][j] - f[i][j])/b;
+                un[i][j] = uo[i][j] - omega * resid;
+                sum = sum + resid*resid;}
+
+        MPI_Waitall(4, req, MPI_STATUSES_IGNORE);
+
+/* Then the edge rows, 1 and l, which read the ghost rows */
+
+#pragma omp parallel for private(i,resid) reduction(+:sum)
+        for(j=1;j<t-1;j++)
+            for(i=1;i<=l;i+=(l>1 ? l-1 : 1))
+                if (i >= lo && i <= hi){
+                    resid = (ax*(uo[i-1][j] + uo[i+1][j]) + ay*(uo[i][j-1] + uo[i][j+1])+ b * uo[i][j] - f[i][j])/b;
+                    un[i][j] = uo[i][j] - omega * resid;
+                    sum = sum + resid*resid;}
+
+/* Error check */
+
+        MPI_Allreduce(&sum, &gsum, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+
+        k = k + 1;
+
+        error = (double)sqrt(gsum)/((double)n*t);
+        if (rank == 0 && log_every > 0 && (k-1) % log_every == 0)
+            printf("Iteration %d Residual=%E\n", k-1, error);
+
+        tmp = un;
+        un = uo;
+        uo = tmp;
+    }
+
+/* The last sweep may have written uold */
+
+    if (uo != u) {
+#pragma omp parallel for private(j)
+        for(i=1;i<=l;i++)
+            for(j=1;j<t-1;j++)
+                u[i][j] = uo[i][j];
+    }
+
+    if (rank == 0) {
+        printf("Total Number of Iterations=%d\n", k);
+        printf("Residual=%E\n", error);
+    }
+
+}
+
+void error_check(int l, int t, int g0, int n, double *dx, double *dy, double u[l+2][t]){
+/************************************************************
+* Checks error between numerical and exact solution
+*
+************************************************************/
+
+    int i,j;
+    double xx,yy,temp,error,gerror;
+
+    *dx = 2.0 / (n-1);
+    *dy = 2.0 / (t-1);
+    error = 0.0;
+
+#pragma omp parallel for private(j,xx,yy,temp) reduction(+:error)
+    for(i=1;i<=l;i++)
+        for(j=0;j<t;j++){
+            xx = -(double)1.0 + *dx * (double)(g0+i-1-1);
+            yy = -(double)1.0 + *dy * (double)(j-1);
+            temp  = u[i][j] - (1.0-xx*xx)*(1.0-yy*yy);
+            error = error + temp*temp ;
+        }
+
+    MPI_Reduce(&error, &gerror, 1, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        gerror = (double)sqrt(gerror)/((double)n*t);
+        printf("Solution Error=%E\n",gerror);
+    }
+
+}
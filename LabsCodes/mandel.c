@@ -1,15 +1,22 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <math.h>
+#include <complex.h>
+#include <unistd.h>
+#include <omp.h>
+#include "prof.h"
 
-#define         X_RESN  2048     /* x resolution */
-#define         Y_RESN  2048       /* y resolution */
+#define         X_RESN  2048     /* default x resolution */
+#define         Y_RESN  2048       /* default y resolution */
 #define         X_MIN   -2.0
 #define         X_MAX    2.0
 #define         Y_MIN   -2.0
 #define         Y_MAX    2.0
 #define		maxIterations	2000
+#define		VLEN	16	/* pixels per lane group */
+#define		MARGIN	0.05	/* of the interior test */
 
 
 typedef struct complextype
@@ -18,25 +25,121 @@ typedef struct complextype
         } Compl;
 
 
-int main ( )
+/*
+   Whether c lies well inside the main cardioid or the period 2 bulb,
+   where the orbit is attracted to a fixed point or a 2-cycle.  The
+   multiplier of the attractor, 1 - sqrt(1 - 4c) for the cardioid and
+   4(c + 1) for the bulb, must be below 1 - MARGIN in modulus, so that
+   points near the boundary, where the float orbit converges slowly and
+   rounding could still make it escape, are iterated as before.
+*/
+static int mandel_interior(float cr, float ci)
 {
+        double complex c = cr + ci * I;
 
-       /* Mandlebrot variables */
-        int i, j, k;
-        Compl   z, c;
+        if (cabs(4.0 * (c + 1.0)) < 1.0 - MARGIN)
+          return 1;
+        return cabs(1.0 - csqrt(1.0 - 4.0 * c)) < 1.0 - MARGIN;
+}
+
+/*
+   Escape iteration counts k[0..VLEN-1] of the VLEN pixels of row i
+   starting at column j, of an xres x yres frame, iterated together in
+   SIMD lanes.  A lane that has escaped keeps its z and count, and the
+   group stops once every lane has escaped or run out of iterations.
+   The arithmetic is that of the scalar loop, with 2.0*z.real*z.imag in
+   double, so the counts are the same.
+
+   With SHORTCUT, lanes for which mandel_interior holds, and lanes whose
+   orbit comes back exactly to the z saved at the last power of two
+   iteration (Brent), so that it cycles and never escapes, are set to
+   maxIterations and stop.
+*/
+static void mandel_simd(int i, int j, int xres, int yres, int k[VLEN],
+                        int shortcut)
+{
+        float zr[VLEN], zi[VLEN], cr[VLEN], ci, sr[VLEN], si[VLEN];
+        int l, it, done[VLEN], left, next;
+
+        ci = Y_MAX - i * (Y_MAX - Y_MIN)/yres;
+        for (l = 0; l < VLEN; l++) {
+          zr[l] = zi[l] = 0.0;
+          cr[l] = X_MIN + (j + l) * (X_MAX - X_MIN)/xres;
+          sr[l] = si[l] = 0.0;
+          done[l] = shortcut && mandel_interior(cr[l], ci);
+          k[l] = done[l] ? maxIterations : 0;
+        }
+        /* keep the lanes going with a cycle test that never fires */
+        if (!shortcut)
+          for (l = 0; l < VLEN; l++)
+            sr[l] = NAN;
+
+        next = 1;
+        for (it = 0; it < maxIterations; it++) {
+          left = 0;
+#pragma omp simd reduction(+:left)
+          for (l = 0; l < VLEN; l++) {
+            float temp = zr[l]*zr[l] - zi[l]*zi[l] + cr[l];
+            float zim = 2.0*zr[l]*zi[l] + ci;
+            float lengthsq = temp*temp + zim*zim;
+            int run = !done[l];
+            int cycle = run & (temp == sr[l]) & (zim == si[l]);
+
+            zr[l] = run ? temp : zr[l];
+            zi[l] = run ? zim : zi[l];
+            k[l] = cycle ? maxIterations : k[l] + run;
+            done[l] = done[l] | cycle | !(lengthsq < 4.0f);
+            left += !done[l];
+          }
+          if (left == 0) break;
+          if (shortcut && it + 1 == next) {
+            for (l = 0; l < VLEN; l++) {
+              sr[l] = zr[l];
+              si[l] = zi[l];
+            }
+            next = 2 * next;
+          }
+        }
+}
+
+/*
+   Pixels i, j of one row, into bit j of the packed row BITS (1 if the
+   point escapes, as res[i][j] was), and, if COUNTS is not NULL, the
+   escape iteration counts into COUNTS.  Whole groups of VLEN pixels go
+   through mandel_simd, the rest of the row, or all of it with SCALAR,
+   through the scalar loop.  Returns the sum of the counts.
+*/
+static long mandel_row(int i, int xres, int yres, int scalar, int shortcut,
+                       unsigned char *bits, unsigned short *counts)
+{
+        int j, k, l, kv[VLEN], next;
+        Compl   z, c, zs;
         float   lengthsq, temp;
-        int res[X_RESN][Y_RESN]; 
+        long ni = 0;
 
+        memset(bits, 0, (xres + 7) / 8);
 
-         
-        /* Calculate and draw points */
-        for(i=0; i < Y_RESN; i++) 
-        for(j=0; j < X_RESN; j++) {
+        j = 0;
+        if (!scalar)
+        for(; j + VLEN <= xres; j += VLEN) {
+          mandel_simd(i, j, xres, yres, kv, shortcut);
+          for (l = 0; l < VLEN; l++) {
+            bits[(j+l) / 8] |= (kv[l] < maxIterations) << ((j+l) % 8);
+            if (counts) counts[j+l] = kv[l];
+            ni += kv[l];
+          }
+        }
+        for(; j < xres; j++) {
           z.real = z.imag = 0.0;
-          c.real = X_MIN + j * (X_MAX - X_MIN)/X_RESN;
-          c.imag = Y_MAX - i * (Y_MAX - Y_MIN)/Y_RESN;
+          c.real = X_MIN + j * (X_MAX - X_MIN)/xres;
+          c.imag = Y_MAX - i * (Y_MAX - Y_MIN)/yres;
           k = 0;
+          zs = z;
+          next = 1;
 
+          if (shortcut && mandel_interior(c.real, c.imag))
+            k = maxIterations;
+          else
           do  {    /* iterate for pixel color */
 
             temp = z.real*z.real - z.imag*z.imag + c.real;
@@ -45,12 +148,201 @@ int main ( )
             lengthsq = z.real*z.real+z.imag*z.imag;
             k++;
 
+            if (shortcut) {
+              if (z.real == zs.real && z.imag == zs.imag) {
+                k = maxIterations;	/* periodic, never escapes */
+                break;
+              }
+              if (k == next) {
+                zs = z;
+                next = 2 * next;
+              }
+            }
+
           } while (lengthsq < 4.0 && k < maxIterations);
 
-        if (k >= maxIterations) res[i][j] = 0;
-        else res[i][j] = 1;
+        bits[j / 8] |= (k < maxIterations) << (j % 8);
+        if (counts) counts[j] = k;
+        ni += k;
+        }
+
+        return ni;
+}
+
+/* Write a row of counts as big endian 16 bit PGM samples. */
+static void pgm_row(FILE *out, int xres, unsigned short *counts,
+                    unsigned char *buf)
+{
+        int j;
+
+        for (j = 0; j < xres; j++) {
+          buf[2*j] = counts[j] >> 8;
+          buf[2*j+1] = counts[j] & 0xff;
+        }
+        fwrite(buf, 2, xres, out);
+}
+
+/* Pixel i, j of the bitmap. */
+static int res_bit(unsigned char *res, int xres, int i, int j)
+{
+        return (res[(size_t) i * ((xres + 7) / 8) + j / 8] >> (j % 8)) & 1;
+}
+
+/*
+   Usage: mandel [-s] [-n] [-x xres] [-y yres] [-o file.pgm]
+
+   The classification of each pixel, 1 if it escapes, is kept as a
+   packed bitmap of (xres+7)/8 bytes a row on the heap.  With -o, the
+   escape iteration counts are also written to a 16 bit binary PGM, one
+   row at a time in order as the rows are completed, so a frame never
+   has to be held in memory.
 
+   The cost of a pixel ranges from 1 to maxIterations iterations, so the
+   rows are shared out with schedule(runtime), dynamic by default
+   (OMP_SCHEDULE="guided" or "static" to compare), and each thread
+   reports the pixels and iterations it did and the time it took.  With
+   -DPROF the row loops of each thread are region "mandel.rows".
+
+   "mandel -s" uses only the scalar loop.  Both kernels skip the
+   interior and stop on periodic orbits as in mandel_simd, which
+   "mandel -n" turns off; the result is the same either way.
+*/
+int main (int argc, char *argv[])
+{
+
+       /* Mandlebrot variables */
+        int i;
+        int xres = X_RESN, yres = Y_RESN;
+        size_t rowbytes;
+        unsigned char *res;
+        char *file = NULL;
+        FILE *out = NULL;
+
+       /* Load balance */
+        int nthreads, id;
+        long *pixels, *iters;
+        double *times, tmax, tsum, t;
+        omp_sched_t kind;
+        int chunk;
+        int scalar = 0, shortcut = 1, opt;
+
+
+        while ((opt = getopt(argc, argv, "snx:y:o:")) != -1) {
+          if (opt == 's') scalar = 1;
+          else if (opt == 'n') shortcut = 0;
+          else if (opt == 'x') xres = atoi(optarg);
+          else if (opt == 'y') yres = atoi(optarg);
+          else if (opt == 'o') file = optarg;
+          else xres = 0;
+        }
+        if (xres < 1 || yres < 1) {
+          fprintf(stderr,
+                  "usage: %s [-s] [-n] [-x xres] [-y yres] [-o file.pgm]\n",
+                  argv[0]);
+          return 1;
         }
-        printf("%d\n", res[0][0], res[127][45], res[320][14]);
+
+        rowbytes = (xres + 7) / 8;
+        res = (unsigned char *) malloc(rowbytes * yres);
+        if (res == NULL) {
+          fprintf(stderr, "%s: cannot allocate %d x %d pixels\n",
+                  argv[0], xres, yres);
+          return 1;
+        }
+        if (file) {
+          out = fopen(file, "wb");
+          if (out == NULL) {
+            fprintf(stderr, "%s: cannot open %s\n", argv[0], file);
+            return 1;
+          }
+          fprintf(out, "P5\n%d %d\n%d\n", xres, yres, maxIterations);
+        }
+
+        if (getenv("OMP_SCHEDULE") == NULL)
+          omp_set_schedule(omp_sched_dynamic, 1);
+        omp_get_schedule(&kind, &chunk);
+        kind = (omp_sched_t) (kind & ~omp_sched_monotonic);
+
+        nthreads = omp_get_max_threads();
+        pixels = (long *) calloc(nthreads, sizeof(long));
+        iters = (long *) calloc(nthreads, sizeof(long));
+        times = (double *) calloc(nthreads, sizeof(double));
          
+        t = omp_get_wtime();
+
+        /* Calculate and draw points */
+#pragma omp parallel private(i, id)
+        {
+        double t0 = omp_get_wtime();
+        long np = 0, ni = 0;
+        unsigned short *counts = NULL;
+        unsigned char *buf = NULL;
+
+        id = omp_get_thread_num();
+
+        PROF_BEGIN("mandel.rows");
+        if (out) {
+          counts = (unsigned short *) malloc(xres * sizeof(unsigned short));
+          buf = (unsigned char *) malloc(2 * (size_t) xres);
+
+          /* the rows are written in order, while later ones are computed */
+#pragma omp for schedule(runtime) ordered nowait
+          for(i=0; i < yres; i++) {
+            ni += mandel_row(i, xres, yres, scalar, shortcut,
+                             res + i * rowbytes, counts);
+            np += xres;
+#pragma omp ordered
+            pgm_row(out, xres, counts, buf);
+          }
+        }
+        else {
+#pragma omp for schedule(runtime) nowait
+          for(i=0; i < yres; i++) {
+            ni += mandel_row(i, xres, yres, scalar, shortcut,
+                             res + i * rowbytes, NULL);
+            np += xres;
+          }
+        }
+        PROF_END("mandel.rows");
+
+        free(counts);
+        free(buf);
+        pixels[id] = np;
+        iters[id] = ni;
+        times[id] = omp_get_wtime() - t0;
+        }
+
+        t = omp_get_wtime() - t;
+
+        if (out && fclose(out) != 0) {
+          fprintf(stderr, "%s: cannot write %s\n", argv[0], file);
+          return 1;
+        }
+
+        if (yres > 320 && xres > 45)
+          printf("%d %d %d\n", res_bit(res, xres, 0, 0),
+                 res_bit(res, xres, 127, 45), res_bit(res, xres, 320, 14));
+
+        /* Report the load balance */
+        printf("%d x %d, schedule %s, chunk %d, %d threads, %.4f s\n",
+               xres, yres,
+               kind == omp_sched_static ? "static" :
+               kind == omp_sched_dynamic ? "dynamic" :
+               kind == omp_sched_guided ? "guided" : "auto", chunk,
+               nthreads, t);
+        tmax = tsum = 0.0;
+        for (id = 0; id < nthreads; id++) {
+          printf("  thread %3d: %9ld pixels %12ld iterations %9.4f s\n",
+                 id, pixels[id], iters[id], times[id]);
+          if (times[id] > tmax) tmax = times[id];
+          tsum += times[id];
+        }
+        printf("  imbalance (max/mean time) %.3f\n",
+               tmax / (tsum / nthreads));
+
+        free(res);
+        free(pixels);
+        free(iters);
+        free(times);
+        return 0;
 }
@@ -14,14 +14,115 @@ John Burkardt.*/
 
 # include <stdlib.h>
 # include <stdio.h>
+# include <string.h>
 # include <math.h>
+# include <unistd.h>
+# include <pthread.h>
+# include <omp.h>
+# include "prof.h"
+
+/*
+  Force evaluation methods.
+*/
+# define MD_ALL_PAIRS 0
+# define MD_CELL_LIST 1
+# define MD_VERLET_LIST 2
+# define MD_HALF_PAIRS 3
+# define MD_VERLET_HALF 4
+# define MD_SIMD_PAIRS 5
+
+char *method_name[] = { "all", "cells", "verlet", "half", "verlet-half", "simd" };
+
+/*
+  Spatial binning and neighbor list state shared by the cell list and
+  Verlet list force evaluations.
+*/
+typedef struct
+{
+  double cutoff;   /* range of the force, beyond which it vanishes */
+  double skin;     /* Verlet skin, 0 for a plain cell list */
+  int half;        /* 1 if each pair is only listed for its lower index */
+  double lo[3];    /* lower corner of the cell grid */
+  double scale[3]; /* cells per unit length in each direction */
+  int nc[3];       /* number of cells in each direction */
+  int ncell_max;   /* allocated size of HEAD */
+  int *head;       /* HEAD[NCELL+1], start of each cell in ORDER */
+  int *order;      /* ORDER[NP], the particles sorted by cell */
+  int *cell;       /* CELL[NP], the cell of each particle */
+  int *start;      /* START[NP+1], start of each neighbor list in LIST */
+  int *list;       /* LIST[LIST_MAX], the neighbor indices */
+  int list_max;    /* allocated size of LIST */
+  double *ps;      /* PS[NP*3], the positions in ORDER */
+  double *pos0;    /* POS0[NP*ND], the positions at the last rebuild */
+  int rebuilds;    /* number of neighbor list rebuilds */
+  double pairs;    /* pair distances examined by the last force evaluation */
+} neighbor;
+
+/*
+  Checkpoint file header.  It is followed by POS, VEL and ACC, each of
+  NP*ND doubles in the coordinate layout.
+*/
+typedef struct
+{
+  char magic[8];   /* "MDCHECK1" */
+  int np;          /* number of particles */
+  int nd;          /* spatial dimension */
+  int step;        /* the time step of the saved state */
+  int pad;
+  double dt;       /* time step */
+  double mass;     /* mass of each particle */
+  double e0;       /* total energy at step 0 */
+} checkpoint_header;
+
+/*
+  Asynchronous checkpoint writer.  The state is copied to BUF and written
+  by a background thread to a temporary file, which is then renamed over
+  PATH, so that PATH always holds the latest complete checkpoint.
+*/
+typedef struct
+{
+  char *path;      /* the checkpoint file */
+  char *tmp;       /* the file being written */
+  int np;          /* number of particles */
+  int nd;          /* spatial dimension */
+  checkpoint_header h;
+  double *buf;     /* BUF[3*NP*ND], the copy of POS, VEL and ACC */
+  pthread_t thread;
+  int busy;        /* 1 while the writer thread runs */
+  int error;       /* set by the writer thread if the write failed */
+  int writes;      /* number of checkpoints written */
+} checkpoint;
 
 int main ( int argc, char *argv[] );
+int lcg_skip ( int seed, long long k );
+int method_lookup ( char *name );
+void cell_build ( int np, int nd, double pos[], double width, neighbor *nb );
+void checkpoint_free ( checkpoint *ck );
+void checkpoint_init ( char *path, int np, int nd, checkpoint *ck );
+void checkpoint_read ( char *path, checkpoint_header *h, double pos[], double vel[], double acc[] );
+void checkpoint_read_header ( char *path, checkpoint_header *h );
+void checkpoint_save ( checkpoint *ck, int step, double dt, double mass, double e0, double pos[], double vel[], double acc[] );
+void checkpoint_wait ( checkpoint *ck );
+void *checkpoint_writer ( void *arg );
 void compute ( int np, int nd, double pos[], double vel[], double mass, double f[], double *pot, double *kin );
-double dist ( int nd, double r1[], double r2[], double dr[] );
+void compute_cells ( int np, int nd, double pos[], double vel[], double mass, double f[], double *pot, double *kin, neighbor *nb );
+void compute_half ( int np, int nd, double pos[], double vel[], double mass, double f[], double *pot, double *kin );
+void compute_simd ( int np, int nd, double pos[], double vel[], double mass, double f[], double *pot, double *kin );
+void compute_verlet ( int np, int nd, double pos[], double vel[], double mass, double f[], double *pot, double *kin, neighbor *nb );
+double dist ( int nd, int stride, double r1[], double r2[], double dr[] );
+double *force_buffers ( size_t n );
 void initialize ( int np, int nd, double pos[], double vel[], double acc[] );
+void neighbor_build ( int np, int nd, double pos[], neighbor *nb );
+void neighbor_free ( neighbor *nb );
+void neighbor_init ( int np, int nd, double cutoff, double skin, int half, neighbor *nb );
+int neighbor_stale ( int np, int nd, double pos[], neighbor *nb );
+# pragma omp declare simd notinbranch
+double pair_p ( double r2 );
+# pragma omp declare simd notinbranch
+double pair_q ( double r2 );
 void r8mat_uniform_ab ( int m, int n, double a, double b, int *seed, double r[] );
 void update ( int np, int nd, double pos[], double vel[], double f[], double acc[], double mass, double dt );
+double update_fused ( int np, int nd, double pos[], double vel[], double f[], double acc[], double mass, double dt );
 
 /******************************************************************************/
 
@@ -40,221 +141,2075 @@ int main ( int argc, char *argv[] )
     The velocity Verlet time integration scheme is used. 
 
     The particles interact with a central pair potential.
+
+    The forces are evaluated either over all pairs, over the particles
+    of neighboring cells of a spatial binning, or from a Verlet neighbor
+    list that is only rebuilt once some particle has moved half the skin.
+
+    The force evaluations are parallelized with OpenMP over the particles.
+    The half pair variants visit each pair once and apply Newton's third
+    law, accumulating the forces in per-thread buffers.
+
+    The particle data is stored by coordinate, X[NP], Y[NP], Z[NP], so
+    that the pair loops over J vectorize.  Except for the reference
+    COMPUTE, the force evaluations assume ND = 3.
+
+    With FUSED set, the kinetic energy is accumulated while updating the
+    velocities instead of in a second pass in the force evaluation.
+
+  Usage:
+
+    md [-n np] [-s step_num] [-t dt] [-m method] [-k skin] [-c]
+       [-w checkpoint_every] [-f checkpoint_file] [-r]
+
+    -n NP, the number of particles, 2000 by default.
+    -s STEP_NUM, the number of time steps, 100 by default.
+    -t DT, the time step, 0.0001 by default.
+    -m METHOD, the force evaluation, one of all, simd, half, cells,
+       verlet or verlet-half, verlet by default.
+    -k SKIN, the Verlet skin radius, 0.3 by default.
+    -c, check mode: compute the kinetic energy in a separate pass.
+    -w CHECKPOINT_EVERY, save the state every so many steps, 0 (never)
+       by default.
+    -f CHECKPOINT_FILE, the checkpoint file, md.chk by default.
+    -r, restart from the checkpoint file.  NP and DT are taken from
+       the file, and the run continues up to STEP_NUM.
+
+    The environment variables MD_NP, MD_STEP_NUM, MD_DT, MD_METHOD,
+    MD_SKIN, MD_CHECKPOINT_EVERY and MD_CHECKPOINT_FILE set the same
+    parameters, and are overridden by the options.
+
+    Checkpoints are written by a background thread, so the time stepping
+    only waits if the previous checkpoint is still being written.
+
+    The run ends with the time spent in each phase, the step rate and
+    the rate of pair distances examined by the force evaluation.
 */
 {
   double *acc;
+  checkpoint ck;
+  int checkpoint_every=0; // steps between checkpoints, 0 for none
+  char *checkpoint_file="md.chk"; // checkpoint file
+  checkpoint_header chk;
   double dt=0.0001; // time step
   double e0;
   double *force;
+  int fused=1; // accumulate the kinetic energy in the update
   int i;
   int id;
+  double *kin;
+  char *env;
   double kinetic;
   double mass = 1.0;
+  int method=MD_VERLET_LIST; // force evaluation method
+  neighbor nb;
   int nd=3;      //spatial dimension
   int np=2000;  // number of particles
+  int opt;
+  double pairs;
+  double PI2 = 3.141592653589793 / 2.0;
   double *pos;
   double potential;
+  int restart=0; // resume from the checkpoint file
+  double skin=0.3; // Verlet skin radius
   int step;
+  int step0;
   int step_num=100; //number of time steps
   int step_print;
   int step_print_index;
   int step_print_num;
+  double t0;
+  double time_compute;
+  double time_init;
+  double time_total;
+  double time_update;
   double *vel;
+/*
+  Read the parameters from the environment, then from the options.
+*/
+  if ( ( env = getenv ( "MD_NP" ) ) != NULL )
+  {
+    np = atoi ( env );
+  }
+  if ( ( env = getenv ( "MD_STEP_NUM" ) ) != NULL )
+  {
+    step_num = atoi ( env );
+  }
+  if ( ( env = getenv ( "MD_DT" ) ) != NULL )
+  {
+    dt = atof ( env );
+  }
+  if ( ( env = getenv ( "MD_METHOD" ) ) != NULL )
+  {
+    method = method_lookup ( env );
+  }
+  if ( ( env = getenv ( "MD_SKIN" ) ) != NULL )
+  {
+    skin = atof ( env );
+  }
+  if ( ( env = getenv ( "MD_CHECKPOINT_EVERY" ) ) != NULL )
+  {
+    checkpoint_every = atoi ( env );
+  }
+  if ( ( env = getenv ( "MD_CHECKPOINT_FILE" ) ) != NULL )
+  {
+    checkpoint_file = env;
+  }
+
+  while ( ( opt = getopt ( argc, argv, "n:s:t:m:k:cw:f:r" ) ) != -1 )
+  {
+    switch ( opt )
+    {
+      case 'n': np = atoi ( optarg ); break;
+      case 's': step_num = atoi ( optarg ); break;
+      case 't': dt = atof ( optarg ); break;
+      case 'm': method = method_lookup ( optarg ); break;
+      case 'k': skin = atof ( optarg ); break;
+      case 'c': fused = 0; break;
+      case 'w': checkpoint_every = atoi ( optarg ); break;
+      case 'f': checkpoint_file = optarg; break;
+      case 'r': restart = 1; break;
+      default:
+        fprintf ( stderr, "Usage: %s [-n np] [-s step_num] [-t dt] [-m method] [-k skin] [-c]\n", argv[0] );
+        fprintf ( stderr, "         [-w checkpoint_every] [-f checkpoint_file] [-r]\n" );
+        exit ( 1 );
+    }
+  }
+
+  e0 = 0.0;
+  step0 = 0;
+  if ( restart )
+  {
+    checkpoint_read_header ( checkpoint_file, &chk );
+    np = chk.np;
+    nd = chk.nd;
+    dt = chk.dt;
+    mass = chk.mass;
+    step0 = chk.step;
+    e0 = chk.e0;
+  }
+
+  if ( np < 2 || step_num < step0 || dt <= 0.0 || method < 0 || skin < 0.0 ||
+    checkpoint_every < 0 )
+  {
+    fprintf ( stderr, "\n" );
+    fprintf ( stderr, "MD - Fatal error!\n" );
+    fprintf ( stderr, "  Illegal parameters NP = %d, STEP_NUM = %d, DT = %g, SKIN = %g.\n",
+      np, step_num, dt, skin );
+    exit ( 1 );
+  }
 
-    
     acc = ( double * ) malloc ( nd * np * sizeof ( double ) );
     force = ( double * ) malloc ( nd * np * sizeof ( double ) );
     pos = ( double * ) malloc ( nd * np * sizeof ( double ) );
     vel = ( double * ) malloc ( nd * np * sizeof ( double ) );
+
+    if ( method != MD_ALL_PAIRS && nd != 3 )
+    {
+      fprintf ( stderr, "\n" );
+      fprintf ( stderr, "MD - Fatal error!\n" );
+      fprintf ( stderr, "  Only the reference method handles ND = %d.\n", nd );
+      exit ( 1 );
+    }
+
+    if ( method == MD_CELL_LIST )
+    {
+      neighbor_init ( np, nd, PI2, 0.0, 0, &nb );
+    }
+    else if ( method == MD_VERLET_LIST || method == MD_VERLET_HALF )
+    {
+      neighbor_init ( np, nd, PI2, skin, method == MD_VERLET_HALF, &nb );
+    }
+
+    if ( 0 < checkpoint_every )
+    {
+      checkpoint_init ( checkpoint_file, np, nd, &ck );
+    }
     
 /*
   This is the main time stepping loop:
     Compute forces and energies,
     Update positions, velocities, accelerations.
 */
- 
-  for ( step = 0; step <= step_num; step++ )
-  {
-    if ( step == 0 )
-    {
-      initialize ( np, nd, pos, vel, acc );
-    }
-    else
-    {
-      update ( np, nd, pos, vel, force, acc, mass, dt );
-    }
+ 
+  time_init = 0.0;
+  time_compute = 0.0;
+  time_update = 0.0;
+  pairs = 0.0;
+  time_total = omp_get_wtime ( );
+
+  for ( step = step0; step <= step_num; step++ )
+  {
+    t0 = omp_get_wtime ( );
+
+    if ( step == step0 && restart )
+    {
+      checkpoint_read ( checkpoint_file, &chk, pos, vel, acc );
+      time_init = omp_get_wtime ( ) - t0;
+    }
+    else if ( step == 0 )
+    {
+      initialize ( np, nd, pos, vel, acc );
+      time_init = omp_get_wtime ( ) - t0;
+    }
+    else
+    {
+      PROF_BEGIN ( "update" );
+      if ( fused )
+      {
+        kinetic = update_fused ( np, nd, pos, vel, force, acc, mass, dt );
+      }
+      else
+      {
+        update ( np, nd, pos, vel, force, acc, mass, dt );
+      }
+      PROF_END ( "update" );
+      time_update = time_update + omp_get_wtime ( ) - t0;
+    }
+
+    kin = ( fused && step0 < step ) ? NULL : &kinetic;
+    t0 = omp_get_wtime ( );
+    PROF_BEGIN ( "forces" );
+
+    if ( method == MD_CELL_LIST )
+    {
+      compute_cells ( np, nd, pos, vel, mass, force, &potential, kin, &nb );
+    }
+    else if ( method == MD_VERLET_LIST || method == MD_VERLET_HALF )
+    {
+      compute_verlet ( np, nd, pos, vel, mass, force, &potential, kin, &nb );
+    }
+    else if ( method == MD_HALF_PAIRS )
+    {
+      compute_half ( np, nd, pos, vel, mass, force, &potential, kin );
+    }
+    else if ( method == MD_SIMD_PAIRS )
+    {
+      compute_simd ( np, nd, pos, vel, mass, force, &potential, kin );
+    }
+    else
+    {
+      compute ( np, nd, pos, vel, mass, force, &potential, kin );
+    }
+
+    PROF_END ( "forces" );
+    time_compute = time_compute + omp_get_wtime ( ) - t0;
+
+    if ( method == MD_ALL_PAIRS )
+    {
+      pairs = pairs + ( double ) np * ( double ) ( np - 1 );
+    }
+    else if ( method == MD_SIMD_PAIRS )
+    {
+      pairs = pairs + ( double ) np * ( double ) np;
+    }
+    else if ( method == MD_HALF_PAIRS )
+    {
+      pairs = pairs + 0.5 * ( double ) np * ( double ) ( np - 1 );
+    }
+    else
+    {
+      pairs = pairs + nb.pairs;
+    }
+
+    if ( step == 0 )
+    {
+      e0 = potential + kinetic;
+    }
+
+    if ( 0 < checkpoint_every && step0 < step && step % checkpoint_every == 0 )
+    {
+      checkpoint_save ( &ck, step, dt, mass, e0, pos, vel, acc );
+    }
+      
+  }
+
+  if ( 0 < checkpoint_every )
+  {
+    checkpoint_wait ( &ck );
+  }
+
+  time_total = omp_get_wtime ( ) - time_total;
+    
+    printf("potential=%f, kinetic=%f, %f\n", potential, kinetic, (potential+kinetic-e0)/e0);
+/*
+  Report the timing.
+*/
+  printf ( "\n" );
+  printf ( "  NP = %d, STEP_NUM = %d, DT = %g, method = %s%s, threads = %d\n",
+    np, step_num, dt, method_name[method], fused ? "" : " (check)",
+    omp_get_max_threads ( ) );
+  if ( restart )
+  {
+    printf ( "  Restarted from step %d of %s\n", step0, checkpoint_file );
+  }
+  if ( 0 < checkpoint_every )
+  {
+    printf ( "  Checkpoints written = %d\n", ck.writes );
+  }
+  if ( method == MD_VERLET_LIST || method == MD_VERLET_HALF )
+  {
+    printf ( "  Neighbor list rebuilds = %d\n", nb.rebuilds );
+  }
+  printf ( "  Initialize  %12.6f s\n", time_init );
+  printf ( "  Compute     %12.6f s\n", time_compute );
+  printf ( "  Update      %12.6f s\n", time_update );
+  printf ( "  Total       %12.6f s\n", time_total );
+  printf ( "  Steps/sec   %12.4g\n", ( step_num - step0 ) / time_total );
+  printf ( "  Pairs/sec   %12.4g\n", pairs / time_compute );
+
+/*
+  Free memory.
+*/
+  if ( method == MD_CELL_LIST || method == MD_VERLET_LIST || method == MD_VERLET_HALF )
+  {
+    neighbor_free ( &nb );
+  }
+  if ( 0 < checkpoint_every )
+  {
+    checkpoint_free ( &ck );
+  }
+  force_buffers ( 0 );
+  free ( acc );
+  free ( force );
+  free ( pos );
+  free ( vel );
+/*
+  Terminate.
+*/
+  return 0;
+}
+/******************************************************************************/
+
+void cell_build ( int np, int nd, double pos[], double width, neighbor *nb )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    CELL_BUILD sorts the particles into the cells of a spatial binning.
+
+  Discussion:
+
+    The cell grid covers the bounding box of the particles, with cells
+    at least WIDTH wide in each direction, so that two particles closer
+    than WIDTH always lie in the same or in adjacent cells.  Should the
+    particles spread out so far that there would be many more cells than
+    particles, the cells are widened.
+
+    The particles are sorted by cell with a counting sort: the particles
+    of cell C are ORDER[HEAD[C]] through ORDER[HEAD[C+1]-1].  Cells are
+    numbered with the X index varying fastest, so that a row of adjacent
+    cells is a contiguous range of ORDER.  The positions are copied in
+    that order to PS, so the pair loops over a row of cells read
+    contiguous memory.
+
+  Parameters:
+
+    Input, int NP, the number of particles.
+
+    Input, int ND, the number of spatial dimensions, at most 3.
+
+    Input, double POS[NP*ND], the positions.
+
+    Input, double WIDTH, the minimum cell width.
+
+    Input/output, neighbor *NB, the binning.
+*/
+{
+  int c;
+  double cells;
+  double ext[3];
+  double hi[3];
+  int i;
+  int ix;
+  int j;
+  int m;
+  int ncell;
+  double t;
+
+  for ( i = 0; i < 3; i++ )
+  {
+    nb->lo[i] = 0.0;
+    hi[i] = 0.0;
+  }
+  for ( i = 0; i < nd; i++ )
+  {
+    nb->lo[i] = pos[i*np];
+    hi[i] = pos[i*np];
+    for ( j = 1; j < np; j++ )
+    {
+      if ( pos[j+i*np] < nb->lo[i] )
+      {
+        nb->lo[i] = pos[j+i*np];
+      }
+      if ( hi[i] < pos[j+i*np] )
+      {
+        hi[i] = pos[j+i*np];
+      }
+    }
+  }
+/*
+  Choose the number of cells, widening them if there would be too many.
+*/
+  for ( ; ; )
+  {
+    cells = 1.0;
+    for ( i = 0; i < 3; i++ )
+    {
+      ext[i] = hi[i] - nb->lo[i];
+      t = floor ( ext[i] / width );
+      if ( t < 1.0 )
+      {
+        t = 1.0;
+      }
+      nb->nc[i] = ( int ) fmin ( t, 2.0 * np + 27.0 );
+      cells = cells * t;
+    }
+    if ( cells <= 2.0 * np + 27.0 )
+    {
+      break;
+    }
+    width = width * 1.25;
+  }
+
+  ncell = nb->nc[0] * nb->nc[1] * nb->nc[2];
+
+  for ( i = 0; i < 3; i++ )
+  {
+    if ( nb->nc[i] == 1 )
+    {
+      nb->scale[i] = 0.0;
+    }
+    else
+    {
+      nb->scale[i] = ( double ) nb->nc[i] / ext[i];
+    }
+  }
+
+  if ( nb->ncell_max < ncell + 1 )
+  {
+    nb->ncell_max = ncell + 1;
+    nb->head = ( int * ) realloc ( nb->head, nb->ncell_max * sizeof ( int ) );
+  }
+/*
+  Count the particles of each cell.
+*/
+  for ( c = 0; c <= ncell; c++ )
+  {
+    nb->head[c] = 0;
+  }
+
+  for ( j = 0; j < np; j++ )
+  {
+    c = 0;
+    for ( i = nd - 1; 0 <= i; i-- )
+    {
+      ix = ( int ) ( ( pos[j+i*np] - nb->lo[i] ) * nb->scale[i] );
+      if ( nb->nc[i] <= ix )
+      {
+        ix = nb->nc[i] - 1;
+      }
+      c = c * nb->nc[i] + ix;
+    }
+    nb->cell[j] = c;
+    nb->head[c+1] = nb->head[c+1] + 1;
+  }
+/*
+  Turn the counts into offsets, scatter the particles, then shift the
+  offsets back, since scattering advanced each HEAD[C] to HEAD[C+1].
+*/
+  for ( c = 0; c < ncell; c++ )
+  {
+    nb->head[c+1] = nb->head[c+1] + nb->head[c];
+  }
+
+  for ( j = 0; j < np; j++ )
+  {
+    c = nb->cell[j];
+    nb->order[nb->head[c]] = j;
+    nb->head[c] = nb->head[c] + 1;
+  }
+
+  for ( c = ncell; 0 < c; c-- )
+  {
+    nb->head[c] = nb->head[c-1];
+  }
+  nb->head[0] = 0;
+/*
+  Copy the positions in cell order.
+*/
+  for ( i = 0; i < 3; i++ )
+  {
+    for ( m = 0; m < np; m++ )
+    {
+      nb->ps[m+i*np] = ( i < nd ) ? pos[nb->order[m]+i*np] : 0.0;
+    }
+  }
+
+  return;
+}
+/******************************************************************************/
+
+void checkpoint_free ( checkpoint *ck )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    CHECKPOINT_FREE frees the memory of a checkpoint writer.
+
+  Parameters:
+
+    Input/output, checkpoint *CK, the checkpoint writer, which must
+    not be busy.
+*/
+{
+  free ( ck->buf );
+  free ( ck->tmp );
+
+  return;
+}
+/******************************************************************************/
+
+void checkpoint_init ( char *path, int np, int nd, checkpoint *ck )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    CHECKPOINT_INIT sets up an idle checkpoint writer.
+
+  Parameters:
+
+    Input, char *PATH, the checkpoint file.
+
+    Input, int NP, the number of particles.
+
+    Input, int ND, the number of spatial dimensions.
+
+    Output, checkpoint *CK, the checkpoint writer.
+*/
+{
+  ck->path = path;
+  ck->np = np;
+  ck->nd = nd;
+  ck->tmp = ( char * ) malloc ( strlen ( path ) + 5 );
+  strcpy ( ck->tmp, path );
+  strcat ( ck->tmp, ".tmp" );
+  ck->buf = ( double * ) malloc ( 3 * nd * np * sizeof ( double ) );
+  ck->busy = 0;
+  ck->error = 0;
+  ck->writes = 0;
+
+  return;
+}
+/******************************************************************************/
+
+void checkpoint_read ( char *path, checkpoint_header *h, double pos[],
+  double vel[], double acc[] )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    CHECKPOINT_READ reads the state saved in a checkpoint file.
+
+  Parameters:
+
+    Input, char *PATH, the checkpoint file.
+
+    Input, checkpoint_header *H, the header, as read by
+    CHECKPOINT_READ_HEADER.
+
+    Output, double POS[NP*ND], VEL[NP*ND], ACC[NP*ND], the positions,
+    velocities and accelerations.
+*/
+{
+  FILE *fp;
+  size_t n;
+
+  n = ( size_t ) h->nd * ( size_t ) h->np;
+
+  fp = fopen ( path, "rb" );
+
+  if ( fp == NULL ||
+    fseek ( fp, ( long ) sizeof ( checkpoint_header ), SEEK_SET ) != 0 ||
+    fread ( pos, sizeof ( double ), n, fp ) != n ||
+    fread ( vel, sizeof ( double ), n, fp ) != n ||
+    fread ( acc, sizeof ( double ), n, fp ) != n )
+  {
+    fprintf ( stderr, "\n" );
+    fprintf ( stderr, "CHECKPOINT_READ - Fatal error!\n" );
+    fprintf ( stderr, "  Cannot read the state from \"%s\".\n", path );
+    exit ( 1 );
+  }
+
+  fclose ( fp );
+
+  return;
+}
+/******************************************************************************/
+
+void checkpoint_read_header ( char *path, checkpoint_header *h )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    CHECKPOINT_READ_HEADER reads the header of a checkpoint file.
+
+  Discussion:
+
+    The header is read before the arrays are allocated, since it fixes
+    the number of particles.
+
+  Parameters:
+
+    Input, char *PATH, the checkpoint file.
+
+    Output, checkpoint_header *H, the header.
+*/
+{
+  FILE *fp;
+
+  fp = fopen ( path, "rb" );
+
+  if ( fp == NULL || fread ( h, sizeof ( checkpoint_header ), 1, fp ) != 1 )
+  {
+    fprintf ( stderr, "\n" );
+    fprintf ( stderr, "CHECKPOINT_READ_HEADER - Fatal error!\n" );
+    fprintf ( stderr, "  Cannot read the checkpoint file \"%s\".\n", path );
+    exit ( 1 );
+  }
+
+  fclose ( fp );
+
+  if ( memcmp ( h->magic, "MDCHECK1", 8 ) != 0 || h->np < 2 || h->nd < 1 ||
+    h->step < 0 )
+  {
+    fprintf ( stderr, "\n" );
+    fprintf ( stderr, "CHECKPOINT_READ_HEADER - Fatal error!\n" );
+    fprintf ( stderr, "  \"%s\" is not an MD checkpoint file.\n", path );
+    exit ( 1 );
+  }
+
+  return;
+}
+/******************************************************************************/
+
+void checkpoint_save ( checkpoint *ck, int step, double dt, double mass,
+  double e0, double pos[], double vel[], double acc[] )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    CHECKPOINT_SAVE starts writing a checkpoint in the background.
+
+  Discussion:
+
+    The state is copied, so the time stepping can go on as soon as this
+    returns.  If the previous checkpoint is still being written, it is
+    waited for first.
+
+  Parameters:
+
+    Input/output, checkpoint *CK, the checkpoint writer.
+
+    Input, int STEP, the current time step.
+
+    Input, double DT, the time step.
+
+    Input, double MASS, the mass of each particle.
+
+    Input, double E0, the total energy at step 0.
+
+    Input, double POS[NP*ND], VEL[NP*ND], ACC[NP*ND], the positions,
+    velocities and accelerations.
+*/
+{
+  size_t n;
+
+  checkpoint_wait ( ck );
+
+  memset ( &ck->h, 0, sizeof ( checkpoint_header ) );
+  memcpy ( ck->h.magic, "MDCHECK1", 8 );
+  ck->h.np = ck->np;
+  ck->h.nd = ck->nd;
+  ck->h.step = step;
+  ck->h.dt = dt;
+  ck->h.mass = mass;
+  ck->h.e0 = e0;
+
+  n = ( size_t ) ck->nd * ( size_t ) ck->np;
+  memcpy ( ck->buf, pos, n * sizeof ( double ) );
+  memcpy ( ck->buf + n, vel, n * sizeof ( double ) );
+  memcpy ( ck->buf + 2 * n, acc, n * sizeof ( double ) );
+
+  if ( pthread_create ( &ck->thread, NULL, checkpoint_writer, ck ) != 0 )
+  {
+    checkpoint_writer ( ck );
+    ck->writes = ck->writes + 1;
+    return;
+  }
+  ck->busy = 1;
+
+  return;
+}
+/******************************************************************************/
+
+void checkpoint_wait ( checkpoint *ck )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    CHECKPOINT_WAIT waits for the checkpoint being written, if any.
+
+  Parameters:
+
+    Input/output, checkpoint *CK, the checkpoint writer.
+*/
+{
+  if ( ck->busy )
+  {
+    pthread_join ( ck->thread, NULL );
+    ck->busy = 0;
+    ck->writes = ck->writes + 1;
+  }
+
+  if ( ck->error )
+  {
+    fprintf ( stderr, "\n" );
+    fprintf ( stderr, "CHECKPOINT_WAIT - Fatal error!\n" );
+    fprintf ( stderr, "  Cannot write the checkpoint file \"%s\".\n", ck->path );
+    exit ( 1 );
+  }
+
+  return;
+}
+/******************************************************************************/
+
+void *checkpoint_writer ( void *arg )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    CHECKPOINT_WRITER writes the copied state to the checkpoint file.
+
+  Discussion:
+
+    The data goes to a temporary file through one large buffered write,
+    and is synced to disk before the file is renamed over the checkpoint,
+    so that an interrupted run never leaves a partial checkpoint behind.
+
+  Parameters:
+
+    Input/output, void *ARG, the checkpoint writer.
+*/
+{
+  checkpoint *ck = ( checkpoint * ) arg;
+  FILE *fp;
+  size_t n;
+
+  n = 3 * ( size_t ) ck->nd * ( size_t ) ck->np;
+
+  fp = fopen ( ck->tmp, "wb" );
+  if ( fp == NULL )
+  {
+    ck->error = 1;
+    return NULL;
+  }
+  setvbuf ( fp, NULL, _IOFBF, 1 << 20 );
+
+  if ( fwrite ( &ck->h, sizeof ( checkpoint_header ), 1, fp ) != 1 ||
+    fwrite ( ck->buf, sizeof ( double ), n, fp ) != n ||
+    fflush ( fp ) != 0 ||
+    fsync ( fileno ( fp ) ) != 0 )
+  {
+    ck->error = 1;
+  }
+  if ( fclose ( fp ) != 0 )
+  {
+    ck->error = 1;
+  }
+
+  if ( ! ck->error && rename ( ck->tmp, ck->path ) != 0 )
+  {
+    ck->error = 1;
+  }
+
+  return NULL;
+}
+/******************************************************************************/
+
+void compute ( int np, int nd, double pos[], double vel[], double mass, 
+  double f[], double *pot, double *kin )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    COMPUTE computes the forces and energies.
+
+  Discussion:
+
+    The potential function V(X) is a harmonic well which smoothly
+    saturates to a maximum value at PI/2:
+
+      v(x) = ( sin ( min ( x, PI/2 ) ) )^2
+
+    The derivative of the potential is:
+
+      dv(x) = 2.0 * sin ( min ( x, PI/2 ) ) * cos ( min ( x, PI/2 ) )
+            = sin ( 2.0 * min ( x, PI/2 ) )
+
+    Each thread computes the whole force on its own particles, so the
+    only shared results are the energies, which are reduced.  With
+    -DPROF the time of each thread in the loop is region "compute", and
+    main times every force evaluation, whatever the method, as "forces".
+
+    This is the reference evaluation, which the faster methods are
+    checked against.
+
+  Parameters:
+
+    Input, int NP, the number of particles.
+
+    Input, int ND, the number of spatial dimensions.
+
+    Input, double POS[NP*ND], the positions.
+
+    Input, double VEL[NP*ND], the velocities.
+
+    Input, double MASS, the mass of each particle.
+
+    Output, double F[NP*ND], the forces.
+
+    Output, double *POT, the total potential energy.
+
+    Output, double *KIN, the total kinetic energy, unless KIN is NULL.
+*/
+{
+  double d;
+  double d2;
+  double pe;
+  double ki;
+  int i;
+  int j;
+  int k;
+  double PI2 = 3.141592653589793 / 2.0;
+  double rij[3];
+
+  pe = 0.0;
+  ki = 0.0;
+
+# pragma omp parallel default ( shared ) private ( d, d2, i, j, k, rij )
+  {
+  PROF_BEGIN ( "compute" );
+# pragma omp for reduction ( + : pe, ki ) nowait
+  for ( k = 0; k < np; k++ )
+  {
+/*
+  Compute the potential energy and forces.
+*/
+    for ( i = 0; i < nd; i++ )
+    {
+      f[k+i*np] = 0.0;
+    }
+
+    for ( j = 0; j < np; j++ )
+    {
+      if ( k != j )
+      {
+        d = dist ( nd, np, pos+k, pos+j, rij );
+/*
+  Attribute half of the potential energy to particle J.
+*/
+        if ( d < PI2 )
+        {
+          d2 = d;
+        }
+        else
+        {
+          d2 = PI2;
+        }
+
+        pe = pe + 0.5 * pow ( sin ( d2 ), 2 );
+
+        for ( i = 0; i < nd; i++ )
+        {
+          f[k+i*np] = f[k+i*np] - rij[i] * sin ( 2.0 * d2 ) / d;
+        }
+      }
+    }
+/*
+  Compute the kinetic energy.
+*/
+    for ( i = 0; i < nd; i++ )
+    {
+      ki = ki + vel[k+i*np] * vel[k+i*np];
+    }
+  }
+  PROF_END ( "compute" );
+  }
+
+  ki = ki * 0.5 * mass;
+  
+  *pot=pe;
+  if ( kin != NULL )
+  {
+    *kin = ki;
+  }
+    
+  return;
+}
+/******************************************************************************/
+
+void compute_cells ( int np, int nd, double pos[], double vel[], double mass, 
+  double f[], double *pot, double *kin, neighbor *nb )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    COMPUTE_CELLS computes the forces and energies using a cell list.
+
+  Discussion:
+
+    The particles are binned into cells at least as wide as the range
+    of the force, so only the particles of the 27 surrounding cells
+    need to be examined.  Each row of three adjacent cells is a
+    contiguous range of the sorted positions, which the inner loop
+    runs over in SIMD lanes.  Pairs beyond the range of the force are
+    masked out arithmetically rather than branched around.
+
+    Every pair farther apart than PI/2 contributes exactly 1/2 to the
+    potential energy, so the energy starts from that value for all
+    pairs and only the nearby pairs correct it, by -cos(d)^2/2.  The
+    inner loop does not skip the particle itself: it contributes no
+    force, and its correction of -1/2 is accounted for by starting from
+    NP*NP rather than NP*(NP-1) pairs.
+
+    The results agree with COMPUTE up to rounding.
+
+  Parameters:
+
+    Input, int NP, the number of particles.
+
+    Input, int ND, the number of spatial dimensions, which must be 3.
+
+    Input, double POS[NP*ND], the positions.
+
+    Input, double VEL[NP*ND], the velocities.
+
+    Input, double MASS, the mass of each particle.
+
+    Output, double F[NP*ND], the forces.
+
+    Output, double *POT, the total potential energy.
+
+    Output, double *KIN, the total kinetic energy, unless KIN is NULL.
+
+    Input/output, neighbor *NB, the binning.
+*/
+{
+  int c;
+  double dx;
+  double dy;
+  double dz;
+  double fx;
+  double fy;
+  double fz;
+  int i;
+  int ix;
+  int iy;
+  int iz;
+  int k;
+  double ki;
+  int m;
+  int p;
+  double pairs;
+  double pe;
+  double q;
+  double r2;
+  double rc2;
+  double s;
+  double w;
+  double *xs;
+  double *ys;
+  double *zs;
+  int x0;
+  int x1;
+  int y;
+  int z;
+
+  cell_build ( np, nd, pos, nb->cutoff, nb );
+
+  rc2 = nb->cutoff * nb->cutoff;
+  xs = nb->ps;
+  ys = nb->ps + np;
+  zs = nb->ps + 2 * np;
+
+  pe = 0.5 * ( double ) np * ( double ) np;
+  ki = 0.0;
+  pairs = 0.0;
+
+# pragma omp parallel for default ( shared ) \
+  private ( c, dx, dy, dz, fx, fy, fz, ix, iy, iz, k, m, q, r2, s, w, x0, x1, y, z ) \
+  reduction ( + : pe, pairs )
+  for ( p = 0; p < np; p++ )
+  {
+    k = nb->order[p];
+    fx = 0.0;
+    fy = 0.0;
+    fz = 0.0;
+
+    c = nb->cell[k];
+    ix = c % nb->nc[0];
+    iy = ( c / nb->nc[0] ) % nb->nc[1];
+    iz = c / ( nb->nc[0] * nb->nc[1] );
+
+    x0 = ( 0 < ix ) ? ix - 1 : ix;
+    x1 = ( ix < nb->nc[0] - 1 ) ? ix + 1 : ix;
+
+    for ( z = iz - 1; z <= iz + 1; z++ )
+    {
+      if ( z < 0 || nb->nc[2] <= z )
+      {
+        continue;
+      }
+      for ( y = iy - 1; y <= iy + 1; y++ )
+      {
+        if ( y < 0 || nb->nc[1] <= y )
+        {
+          continue;
+        }
+        c = ( z * nb->nc[1] + y ) * nb->nc[0];
+        pairs = pairs + ( nb->head[c+x1+1] - nb->head[c+x0] );
+
+# pragma omp simd private ( dx, dy, dz, q, r2, s, w ) reduction ( + : pe, fx, fy, fz )
+        for ( m = nb->head[c+x0]; m < nb->head[c+x1+1]; m++ )
+        {
+          dx = xs[p] - xs[m];
+          dy = ys[p] - ys[m];
+          dz = zs[p] - zs[m];
+          r2 = dx * dx + dy * dy + dz * dz;
+
+          s = ( r2 < rc2 ) ? 1.0 : 0.0;
+          r2 = s * r2;
+          q = pair_q ( r2 );
+          pe = pe - 0.5 * s * q * q;
+          w = 2.0 * s * pair_p ( r2 ) * q;
+          fx = fx - dx * w;
+          fy = fy - dy * w;
+          fz = fz - dz * w;
+        }
+      }
+    }
+
+    f[k] = fx;
+    f[k+np] = fy;
+    f[k+2*np] = fz;
+  }
+
+  nb->pairs = pairs;
+
+  if ( kin != NULL )
+  {
+# pragma omp parallel for simd reduction ( + : ki )
+    for ( i = 0; i < nd * np; i++ )
+    {
+      ki = ki + vel[i] * vel[i];
+    }
+  }
+
+  ki = ki * 0.5 * mass;
+
+  *pot = pe;
+  if ( kin != NULL )
+  {
+    *kin = ki;
+  }
+
+  return;
+}
+/******************************************************************************/
+
+void compute_half ( int np, int nd, double pos[], double vel[], double mass, 
+  double f[], double *pot, double *kin )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    COMPUTE_HALF computes the forces and energies over half of the pairs.
+
+  Discussion:
+
+    Each pair K < J is visited once, and by Newton's third law its force
+    is added to particle K and subtracted from particle J.  Since any
+    thread may then update any particle, each thread accumulates into a
+    buffer of its own, and the buffers are summed at the end.
+
+    The inner loop runs over contiguous J in SIMD lanes, with the
+    clamp of the distance to PI/2 done arithmetically, as in COMPUTE_SIMD.
+
+    The results agree with COMPUTE up to rounding.
+
+  Parameters:
+
+    Input, int NP, the number of particles.
+
+    Input, int ND, the number of spatial dimensions, which must be 3.
+
+    Input, double POS[NP*ND], the positions.
+
+    Input, double VEL[NP*ND], the velocities.
+
+    Input, double MASS, the mass of each particle.
+
+    Output, double F[NP*ND], the forces.
+
+    Output, double *POT, the total potential energy.
+
+    Output, double *KIN, the total kinetic energy, unless KIN is NULL.
+*/
+{
+  double dx;
+  double dy;
+  double dz;
+  double *fbuf;
+  double *ft;
+  double fx;
+  double fy;
+  double fz;
+  int i;
+  int j;
+  int k;
+  double ki;
+  int nt;
+  double p;
+  double pe;
+  double PI2 = 3.141592653589793 / 2.0;
+  double r2;
+  double rc2;
+  double s;
+  int t;
+  double w;
+  double *x;
+  double *y;
+  double *z;
+
+  nt = omp_get_max_threads ( );
+  fbuf = force_buffers ( ( size_t ) nt * nd * np );
+
+  rc2 = PI2 * PI2;
+  x = pos;
+  y = pos + np;
+  z = pos + 2 * np;
+
+  pe = 0.0;
+  ki = 0.0;
+
+# pragma omp parallel default ( shared ) \
+  private ( dx, dy, dz, ft, fx, fy, fz, i, j, k, p, r2, s, t, w ) \
+  reduction ( + : pe )
+  {
+    ft = fbuf + ( size_t ) omp_get_thread_num ( ) * nd * np;
+
+    for ( i = 0; i < nd * np; i++ )
+    {
+      ft[i] = 0.0;
+    }
+/*
+  The rows shrink with K, so hand them out in decreasing chunks.
+*/
+# pragma omp for schedule ( guided )
+    for ( k = 0; k < np; k++ )
+    {
+      fx = 0.0;
+      fy = 0.0;
+      fz = 0.0;
+
+# pragma omp simd private ( dx, dy, dz, p, r2, s, w ) reduction ( + : pe, fx, fy, fz )
+      for ( j = k + 1; j < np; j++ )
+      {
+        dx = x[k] - x[j];
+        dy = y[k] - y[j];
+        dz = z[k] - z[j];
+        r2 = dx * dx + dy * dy + dz * dz;
+
+        s = ( r2 < rc2 ) ? 1.0 : 0.0;
+        r2 = s * r2 + ( 1.0 - s ) * rc2;
+        p = pair_p ( r2 );
+/*
+  The pair energy counts once for each of the two particles.
+*/
+        pe = pe + r2 * p * p;
+
+        w = 2.0 * s * p * pair_q ( r2 );
+        fx = fx - dx * w;
+        fy = fy - dy * w;
+        fz = fz - dz * w;
+        ft[j] = ft[j] + dx * w;
+        ft[j+np] = ft[j+np] + dy * w;
+        ft[j+2*np] = ft[j+2*np] + dz * w;
+      }
+
+      ft[k] = ft[k] + fx;
+      ft[k+np] = ft[k+np] + fy;
+      ft[k+2*np] = ft[k+2*np] + fz;
+    }
+/*
+  Merge the thread buffers and compute the kinetic energy.
+*/
+# pragma omp for
+    for ( i = 0; i < nd * np; i++ )
+    {
+      f[i] = 0.0;
+      for ( t = 0; t < omp_get_num_threads ( ); t++ )
+      {
+        f[i] = f[i] + fbuf[i+( size_t ) t*nd*np];
+      }
+    }
+
+    if ( kin != NULL )
+    {
+# pragma omp for simd reduction ( + : ki )
+      for ( i = 0; i < nd * np; i++ )
+      {
+        ki = ki + vel[i] * vel[i];
+      }
+    }
+  }
+
+  ki = ki * 0.5 * mass;
+
+  *pot = pe;
+  if ( kin != NULL )
+  {
+    *kin = ki;
+  }
+
+  return;
+}
+/******************************************************************************/
+
+void compute_simd ( int np, int nd, double pos[], double vel[], double mass, 
+  double f[], double *pot, double *kin )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    COMPUTE_SIMD computes the forces and energies over all pairs in SIMD lanes.
+
+  Discussion:
+
+    The inner loop runs over contiguous J.  The clamp of the distance
+    to PI/2 is done arithmetically, by evaluating the potential at the
+    squared distance S*R2 + (1-S)*(PI/2)^2, with S = 1 inside the range
+    of the force and 0 beyond, and SIN and COS are replaced by the
+    polynomials PAIR_P and PAIR_Q in the squared distance, so the loop
+    has no branch, square root or division.
+
+    The particle itself is not skipped, since at distance 0 it
+    contributes neither energy nor force.
+
+    The results agree with COMPUTE up to rounding.
+
+  Parameters:
+
+    Input, int NP, the number of particles.
+
+    Input, int ND, the number of spatial dimensions, which must be 3.
+
+    Input, double POS[NP*ND], the positions.
+
+    Input, double VEL[NP*ND], the velocities.
+
+    Input, double MASS, the mass of each particle.
+
+    Output, double F[NP*ND], the forces.
+
+    Output, double *POT, the total potential energy.
+
+    Output, double *KIN, the total kinetic energy, unless KIN is NULL.
+*/
+{
+  double dx;
+  double dy;
+  double dz;
+  double fx;
+  double fy;
+  double fz;
+  int i;
+  int j;
+  int k;
+  double ki;
+  double p;
+  double pe;
+  double PI2 = 3.141592653589793 / 2.0;
+  double r2;
+  double rc2;
+  double s;
+  double w;
+  double *x;
+  double *y;
+  double *z;
+
+  rc2 = PI2 * PI2;
+  x = pos;
+  y = pos + np;
+  z = pos + 2 * np;
+
+  pe = 0.0;
+  ki = 0.0;
+
+# pragma omp parallel for default ( shared ) \
+  private ( dx, dy, dz, fx, fy, fz, j, k, p, r2, s, w ) \
+  reduction ( + : pe )
+  for ( k = 0; k < np; k++ )
+  {
+    fx = 0.0;
+    fy = 0.0;
+    fz = 0.0;
+
+# pragma omp simd private ( dx, dy, dz, p, r2, s, w ) reduction ( + : pe, fx, fy, fz )
+    for ( j = 0; j < np; j++ )
+    {
+      dx = x[k] - x[j];
+      dy = y[k] - y[j];
+      dz = z[k] - z[j];
+      r2 = dx * dx + dy * dy + dz * dz;
+
+      s = ( r2 < rc2 ) ? 1.0 : 0.0;
+      r2 = s * r2 + ( 1.0 - s ) * rc2;
+      p = pair_p ( r2 );
+
+      pe = pe + 0.5 * r2 * p * p;
+
+      w = 2.0 * s * p * pair_q ( r2 );
+      fx = fx - dx * w;
+      fy = fy - dy * w;
+      fz = fz - dz * w;
+    }
+
+    f[k] = fx;
+    f[k+np] = fy;
+    f[k+2*np] = fz;
+  }
+
+  if ( kin != NULL )
+  {
+# pragma omp parallel for simd reduction ( + : ki )
+    for ( i = 0; i < nd * np; i++ )
+    {
+      ki = ki + vel[i] * vel[i];
+    }
+  }
+
+  ki = ki * 0.5 * mass;
+
+  *pot = pe;
+  if ( kin != NULL )
+  {
+    *kin = ki;
+  }
+
+  return;
+}
+/******************************************************************************/
+
+void compute_verlet ( int np, int nd, double pos[], double vel[], double mass, 
+  double f[], double *pot, double *kin, neighbor *nb )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    COMPUTE_VERLET computes the forces and energies using a Verlet list.
+
+  Discussion:
+
+    Each particle keeps the list of particles within the range of the
+    force plus a skin.  The list stays valid until some particle has
+    moved half the skin away from where it was when the list was built,
+    and is rebuilt from a cell list at that point.
+
+    The potential energy is accumulated as in COMPUTE_CELLS.  With a
+    half list each pair appears once, and the forces are accumulated
+    in per-thread buffers as in COMPUTE_HALF.  The inner loops gather
+    the neighbor positions into SIMD lanes.
+
+  Parameters:
+
+    Input, int NP, the number of particles.
+
+    Input, int ND, the number of spatial dimensions, which must be 3.
+
+    Input, double POS[NP*ND], the positions.
+
+    Input, double VEL[NP*ND], the velocities.
+
+    Input, double MASS, the mass of each particle.
+
+    Output, double F[NP*ND], the forces.
+
+    Output, double *POT, the total potential energy.
+
+    Output, double *KIN, the total kinetic energy, unless KIN is NULL.
+
+    Input/output, neighbor *NB, the neighbor list.
+*/
+{
+  double dx;
+  double dy;
+  double dz;
+  double *fbuf;
+  double *ft;
+  double fx;
+  double fy;
+  double fz;
+  int i;
+  int j;
+  int k;
+  double ki;
+  int m;
+  int nt;
+  double pe;
+  double q;
+  double r2;
+  double rc2;
+  double s;
+  int t;
+  double w;
+  double *x;
+  double *y;
+  double *z;
+
+  if ( neighbor_stale ( np, nd, pos, nb ) )
+  {
+    neighbor_build ( np, nd, pos, nb );
+  }
+  nb->pairs = ( double ) nb->start[np];
+
+  rc2 = nb->cutoff * nb->cutoff;
+  x = pos;
+  y = pos + np;
+  z = pos + 2 * np;
+
+  pe = 0.5 * ( double ) np * ( double ) ( np - 1 );
+  ki = 0.0;
+
+  if ( !nb->half )
+  {
+# pragma omp parallel for default ( shared ) \
+  private ( dx, dy, dz, fx, fy, fz, j, k, m, q, r2, s, w ) \
+  reduction ( + : pe )
+    for ( k = 0; k < np; k++ )
+    {
+      fx = 0.0;
+      fy = 0.0;
+      fz = 0.0;
+
+# pragma omp simd private ( dx, dy, dz, j, q, r2, s, w ) reduction ( + : pe, fx, fy, fz )
+      for ( m = nb->start[k]; m < nb->start[k+1]; m++ )
+      {
+        j = nb->list[m];
+        dx = x[k] - x[j];
+        dy = y[k] - y[j];
+        dz = z[k] - z[j];
+        r2 = dx * dx + dy * dy + dz * dz;
+
+        s = ( r2 < rc2 ) ? 1.0 : 0.0;
+        r2 = s * r2;
+        q = pair_q ( r2 );
+        pe = pe - 0.5 * s * q * q;
+        w = 2.0 * s * pair_p ( r2 ) * q;
+        fx = fx - dx * w;
+        fy = fy - dy * w;
+        fz = fz - dz * w;
+      }
+
+      f[k] = fx;
+      f[k+np] = fy;
+      f[k+2*np] = fz;
+    }
+
+    if ( kin != NULL )
+    {
+# pragma omp parallel for simd reduction ( + : ki )
+      for ( i = 0; i < nd * np; i++ )
+      {
+        ki = ki + vel[i] * vel[i];
+      }
+    }
+  }
+  else
+  {
+    nt = omp_get_max_threads ( );
+    fbuf = force_buffers ( ( size_t ) nt * nd * np );
+
+# pragma omp parallel default ( shared ) \
+  private ( dx, dy, dz, ft, fx, fy, fz, i, j, k, m, q, r2, s, t, w ) \
+  reduction ( + : pe )
+    {
+      ft = fbuf + ( size_t ) omp_get_thread_num ( ) * nd * np;
+
+      for ( i = 0; i < nd * np; i++ )
+      {
+        ft[i] = 0.0;
+      }
+
+# pragma omp for schedule ( guided )
+      for ( k = 0; k < np; k++ )
+      {
+        fx = 0.0;
+        fy = 0.0;
+        fz = 0.0;
+/*
+  The neighbors of one particle are distinct, so the scattered updates
+  of the lanes never collide.
+*/
+# pragma omp simd private ( dx, dy, dz, j, q, r2, s, w ) reduction ( + : pe, fx, fy, fz )
+        for ( m = nb->start[k]; m < nb->start[k+1]; m++ )
+        {
+          j = nb->list[m];
+          dx = x[k] - x[j];
+          dy = y[k] - y[j];
+          dz = z[k] - z[j];
+          r2 = dx * dx + dy * dy + dz * dz;
+
+          s = ( r2 < rc2 ) ? 1.0 : 0.0;
+          r2 = s * r2;
+          q = pair_q ( r2 );
+          pe = pe - s * q * q;
+          w = 2.0 * s * pair_p ( r2 ) * q;
+          fx = fx - dx * w;
+          fy = fy - dy * w;
+          fz = fz - dz * w;
+          ft[j] = ft[j] + dx * w;
+          ft[j+np] = ft[j+np] + dy * w;
+          ft[j+2*np] = ft[j+2*np] + dz * w;
+        }
+
+        ft[k] = ft[k] + fx;
+        ft[k+np] = ft[k+np] + fy;
+        ft[k+2*np] = ft[k+2*np] + fz;
+      }
+
+# pragma omp for
+      for ( i = 0; i < nd * np; i++ )
+      {
+        f[i] = 0.0;
+        for ( t = 0; t < omp_get_num_threads ( ); t++ )
+        {
+          f[i] = f[i] + fbuf[i+( size_t ) t*nd*np];
+        }
+      }
+
+      if ( kin != NULL )
+      {
+# pragma omp for simd reduction ( + : ki )
+        for ( i = 0; i < nd * np; i++ )
+        {
+          ki = ki + vel[i] * vel[i];
+        }
+      }
+    }
+  }
+
+  ki = ki * 0.5 * mass;
+
+  *pot = pe;
+  if ( kin != NULL )
+  {
+    *kin = ki;
+  }
+
+  return;
+}
+/******************************************************************************/
+
+double dist ( int nd, int stride, double r1[], double r2[], double dr[] )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    DIST computes the displacement (and its norm) between two particles.
+
+  Parameters:
+
+    Input, int ND, the number of spatial dimensions.
+
+    Input, int STRIDE, the distance between the coordinates of a particle.
+
+    Input, double R1[ND*STRIDE], R2[ND*STRIDE], the positions of the particles.
+
+    Output, double DR[ND], the displacement vector.
+
+    Output, double D, the Euclidean norm of the displacement.
+*/
+{
+  double d;
+  int i;
+
+  d = 0.0;
+  for ( i = 0; i < nd; i++ )
+  {
+    dr[i] = r1[i*stride] - r2[i*stride];
+    d = d + dr[i] * dr[i];
+  }
+  d = sqrt ( d );
+
+  return d;
+}
+/******************************************************************************/
+
+double *force_buffers ( size_t n )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    FORCE_BUFFERS returns the per-thread force buffers of the half pair
+    evaluations.
+
+  Discussion:
+
+    The buffers are kept from one force evaluation to the next, and only
+    reallocated when a larger size is asked for, so that they are not
+    allocated and first touched again every step.
+
+  Parameters:
+
+    Input, size_t N, the number of doubles needed, or 0 to free the
+    buffers.
+
+    Output, double *FORCE_BUFFERS, room for N doubles.
+*/
+{
+  static double *buf = NULL;
+  static size_t buf_max = 0;
+
+  if ( n == 0 || buf_max < n )
+  {
+    free ( buf );
+    buf = NULL;
+    buf_max = 0;
+  }
+  if ( n == 0 || buf != NULL )
+  {
+    return buf;
+  }
+
+  buf = ( double * ) malloc ( n * sizeof ( double ) );
+  if ( buf == NULL )
+  {
+    fprintf ( stderr, "MD - Cannot allocate %zu doubles of force buffers.\n", n );
+    exit ( 1 );
+  }
+  buf_max = n;
+
+  return buf;
+}
+/******************************************************************************/
+
+void initialize ( int np, int nd, double pos[], double vel[], double acc[] )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    INITIALIZE initializes the positions, velocities, and accelerations.
+
+  Discussion:
+
+    The random positions are drawn particle by particle, as in the
+    interleaved layout, and then transposed, so the initial state does
+    not depend on the layout.  All arrays are filled in parallel, and
+    the positions do not depend on the number of threads.
+
+    The box side is 10 for the default 2000 particles, and grows as
+    NP^(1/ND), so the density, and with it the number of neighbors
+    within the cutoff, stays the same and the cell and Verlet methods
+    scale linearly with NP.
+
+  Parameters:
+
+    Input, int NP, the number of particles.
+
+    Input, int ND, the number of spatial dimensions.
+
+    Output, double POS[NP*ND], the positions.
+
+    Output, double VEL[NP*ND], the velocities.
+
+    Output, double ACC[NP*ND], the accelerations.
+*/
+{
+  int i;
+  int j;
+  double *r;
+  int seed;
+  double side;
+/*
+  Set positions.
+*/
+  r = ( double * ) malloc ( nd * np * sizeof ( double ) );
+
+  seed = 123456789;
+  side = 10.0 * pow ( np / 2000.0, 1.0 / nd );
+  r8mat_uniform_ab ( nd, np, 0.0, side, &seed, r );
+
+# pragma omp parallel for default ( shared ) private ( i, j )
+  for ( j = 0; j < np; j++ )
+  {
+    for ( i = 0; i < nd; i++ )
+    {
+      pos[j+i*np] = r[i+j*nd];
+    }
+  }
+
+  free ( r );
+/*
+  Set velocities and accelerations.
+*/
+# pragma omp parallel for simd
+  for ( j = 0; j < nd * np; j++ )
+  {
+    vel[j] = 0.0;
+    acc[j] = 0.0;
+  }
+
+  return;
+}
+/******************************************************************************/
+
+int lcg_skip ( int seed, long long k )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    LCG_SKIP jumps the seed of R8MAT_UNIFORM_AB ahead by K steps.
+
+  Discussion:
+
+    K steps of the recursion multiply the seed by 16807^K mod ( 2^31 - 1 ),
+    which is computed by repeated squaring in O(log K) operations.
+    The products stay below 2^62.
+
+  Parameters:
+
+    Input, int SEED, the seed, between 1 and 2^31 - 2.
+
+    Input, long long K, the number of steps to skip.
+
+    Output, int LCG_SKIP, the seed K steps later.
+*/
+{
+  const long long i4_huge = 2147483647;
+  long long p;
+  long long s;
 
-    compute ( np, nd, pos, vel, mass, force, &potential, &kinetic );
+  s = seed;
+  p = 16807;
 
-    if ( step == 0 )
+  while ( 0 < k )
+  {
+    if ( k % 2 == 1 )
     {
-      e0 = potential + kinetic;
+      s = ( s * p ) % i4_huge;
     }
-      
+    p = ( p * p ) % i4_huge;
+    k = k / 2;
   }
-    
-    printf("potential=%f, kinetic=%f, %f\n", potential, kinetic, (potential+kinetic-e0)/e0);
 
-/*
-  Free memory.
-*/
-  free ( acc );
-  free ( force );
-  free ( pos );
-  free ( vel );
-/*
-  Terminate.
-*/
-  return 0;
+  return ( int ) s;
 }
 /******************************************************************************/
 
-void compute ( int np, int nd, double pos[], double vel[], double mass, 
-  double f[], double *pot, double *kin )
+int method_lookup ( char *name )
 
 /******************************************************************************/
 /*
   Purpose:
 
-    COMPUTE computes the forces and energies.
+    METHOD_LOOKUP returns the force evaluation method of a given name.
 
-  Discussion:
+  Parameters:
 
-    The potential function V(X) is a harmonic well which smoothly
-    saturates to a maximum value at PI/2:
+    Input, char *NAME, the name of the method.
 
-      v(x) = ( sin ( min ( x, PI/2 ) ) )^2
+    Output, int METHOD_LOOKUP, the method, or -1 if there is none
+    of that name.
+*/
+{
+  int method;
 
-    The derivative of the potential is:
+  for ( method = 0; method < ( int ) ( sizeof ( method_name ) / sizeof ( method_name[0] ) ); method++ )
+  {
+    if ( strcmp ( name, method_name[method] ) == 0 )
+    {
+      return method;
+    }
+  }
 
-      dv(x) = 2.0 * sin ( min ( x, PI/2 ) ) * cos ( min ( x, PI/2 ) )
-            = sin ( 2.0 * min ( x, PI/2 ) )
+  fprintf ( stderr, "MD - Unknown method \"%s\".\n", name );
 
-  Parameters:
+  return -1;
+}
+/******************************************************************************/
 
-    Input, int NP, the number of particles.
+void neighbor_build ( int np, int nd, double pos[], neighbor *nb )
 
-    Input, int ND, the number of spatial dimensions.
+/******************************************************************************/
+/*
+  Purpose:
 
-    Input, double POS[ND*NP], the positions.
+    NEIGHBOR_BUILD rebuilds the Verlet neighbor list.
 
-    Input, double VEL[ND*NP], the velocities.
+  Discussion:
 
-    Input, double MASS, the mass of each particle.
+    The particles are binned into cells as wide as the range of the
+    force plus the skin, and the neighbors of particle K within that
+    distance are stored in LIST[START[K]] through LIST[START[K+1]-1].
+    A half list only keeps the neighbors J > K.  The positions are saved
+    to detect when the list goes stale.
 
-    Output, double F[ND*NP], the forces.
+    The particles are scanned twice in parallel, first to count the
+    neighbors of each particle and then, once the counts have been
+    turned into offsets, to store them.  The candidates of each row of
+    cells are read from the sorted positions.
 
-    Output, double *POT, the total potential energy.
+  Parameters:
+
+    Input, int NP, the number of particles.
 
-    Output, double *KIN, the total kinetic energy.
+    Input, int ND, the number of spatial dimensions, at most 3.
+
+    Input, double POS[NP*ND], the positions.
+
+    Input/output, neighbor *NB, the neighbor list.
 */
 {
-  double d;
-  double d2;
-  double pe;
-  double ki;
+  int c;
+  double dx;
+  double dy;
+  double dz;
   int i;
+  int ix;
+  int iy;
+  int iz;
   int j;
   int k;
-  double PI2 = 3.141592653589793 / 2.0;
-  double rij[3];
-
-  pe = 0.0;
-  ki = 0.0;
-
-  for ( k = 0; k < np; k++ )
+  int m;
+  int n;
+  int p;
+  int pass;
+  double rc;
+  double rc2;
+  double *xs;
+  double *ys;
+  double *zs;
+  int x0;
+  int x1;
+  int y;
+  int z;
+
+  rc = nb->cutoff + nb->skin;
+
+  cell_build ( np, nd, pos, rc, nb );
+
+  rc2 = rc * rc;
+  xs = nb->ps;
+  ys = nb->ps + np;
+  zs = nb->ps + 2 * np;
+
+  for ( pass = 0; pass < 2; pass++ )
   {
-/*
-  Compute the potential energy and forces.
-*/
-    for ( i = 0; i < nd; i++ )
+# pragma omp parallel for default ( shared ) schedule ( dynamic, 64 ) \
+  private ( c, dx, dy, dz, ix, iy, iz, j, k, m, n, x0, x1, y, z )
+    for ( p = 0; p < np; p++ )
     {
-      f[i+k*nd] = 0.0;
-    }
+      k = nb->order[p];
+      n = ( pass == 0 ) ? 0 : nb->start[k];
 
-    for ( j = 0; j < np; j++ )
-    {
-      if ( k != j )
+      c = nb->cell[k];
+      ix = c % nb->nc[0];
+      iy = ( c / nb->nc[0] ) % nb->nc[1];
+      iz = c / ( nb->nc[0] * nb->nc[1] );
+
+      x0 = ( 0 < ix ) ? ix - 1 : ix;
+      x1 = ( ix < nb->nc[0] - 1 ) ? ix + 1 : ix;
+
+      for ( z = iz - 1; z <= iz + 1; z++ )
       {
-        d = dist ( nd, pos+k*nd, pos+j*nd, rij );
-/*
-  Attribute half of the potential energy to particle J.
-*/
-        if ( d < PI2 )
+        if ( z < 0 || nb->nc[2] <= z )
         {
-          d2 = d;
+          continue;
         }
-        else
+        for ( y = iy - 1; y <= iy + 1; y++ )
         {
-          d2 = PI2;
+          if ( y < 0 || nb->nc[1] <= y )
+          {
+            continue;
+          }
+          c = ( z * nb->nc[1] + y ) * nb->nc[0];
+
+          for ( m = nb->head[c+x0]; m < nb->head[c+x1+1]; m++ )
+          {
+            j = nb->order[m];
+            if ( j == k || ( nb->half && j < k ) )
+            {
+              continue;
+            }
+            dx = xs[p] - xs[m];
+            dy = ys[p] - ys[m];
+            dz = zs[p] - zs[m];
+
+            if ( dx * dx + dy * dy + dz * dz < rc2 )
+            {
+              if ( pass == 1 )
+              {
+                nb->list[n] = j;
+              }
+              n = n + 1;
+            }
+          }
         }
+      }
 
-        pe = pe + 0.5 * pow ( sin ( d2 ), 2 );
-
-        for ( i = 0; i < nd; i++ )
-        {
-          f[i+k*nd] = f[i+k*nd] - rij[i] * sin ( 2.0 * d2 ) / d;
-        }
+      if ( pass == 0 )
+      {
+        nb->start[k+1] = n;
       }
     }
 /*
-  Compute the kinetic energy.
+  Turn the counts into offsets and make room for the list.
 */
-    for ( i = 0; i < nd; i++ )
+    if ( pass == 0 )
     {
-      ki = ki + vel[i+k*nd] * vel[i+k*nd];
+      nb->start[0] = 0;
+      for ( k = 0; k < np; k++ )
+      {
+        nb->start[k+1] = nb->start[k+1] + nb->start[k];
+      }
+      if ( nb->list_max < nb->start[np] )
+      {
+        nb->list_max = nb->start[np] + nb->start[np] / 4;
+        free ( nb->list );
+        nb->list = ( int * ) malloc ( nb->list_max * sizeof ( int ) );
+      }
     }
   }
 
-  ki = ki * 0.5 * mass;
-  
-  *pot=pe;
-  *kin=ki;
-    
+  for ( i = 0; i < nd * np; i++ )
+  {
+    nb->pos0[i] = pos[i];
+  }
+
+  nb->rebuilds = nb->rebuilds + 1;
+
   return;
 }
+/******************************************************************************/
 
-double dist ( int nd, double r1[], double r2[], double dr[] )
+void neighbor_free ( neighbor *nb )
 
 /******************************************************************************/
 /*
   Purpose:
 
-    DIST computes the displacement (and its norm) between two particles.
+    NEIGHBOR_FREE frees the memory of a neighbor list.
 
   Parameters:
 
-    Input, int ND, the number of spatial dimensions.
+    Input/output, neighbor *NB, the neighbor list.
+*/
+{
+  free ( nb->head );
+  free ( nb->order );
+  free ( nb->cell );
+  free ( nb->start );
+  free ( nb->list );
+  free ( nb->ps );
+  free ( nb->pos0 );
 
-    Input, double R1[ND], R2[ND], the positions of the particles.
+  return;
+}
+/******************************************************************************/
 
-    Output, double DR[ND], the displacement vector.
+void neighbor_init ( int np, int nd, double cutoff, double skin, int half,
+  neighbor *nb )
 
-    Output, double D, the Euclidean norm of the displacement.
+/******************************************************************************/
+/*
+  Purpose:
+
+    NEIGHBOR_INIT sets up an empty cell list or Verlet neighbor list.
+
+  Parameters:
+
+    Input, int NP, the number of particles.
+
+    Input, int ND, the number of spatial dimensions, at most 3.
+
+    Input, double CUTOFF, the range of the force.
+
+    Input, double SKIN, the Verlet skin, or 0 for a plain cell list.
+
+    Input, int HALF, is 1 to list each pair only once.
+
+    Output, neighbor *NB, the neighbor list.
 */
 {
-  double d;
-  int i;
-
-  d = 0.0;
-  for ( i = 0; i < nd; i++ )
+  if ( nd < 1 || 3 < nd )
   {
-    dr[i] = r1[i] - r2[i];
-    d = d + dr[i] * dr[i];
+    fprintf ( stderr, "\n" );
+    fprintf ( stderr, "NEIGHBOR_INIT - Fatal error!\n" );
+    fprintf ( stderr, "  Cannot bin in ND = %d dimensions.\n", nd );
+    exit ( 1 );
   }
-  d = sqrt ( d );
 
-  return d;
+  nb->cutoff = cutoff;
+  nb->skin = skin;
+  nb->half = half;
+  nb->ncell_max = 0;
+  nb->head = NULL;
+  nb->order = ( int * ) malloc ( np * sizeof ( int ) );
+  nb->cell = ( int * ) malloc ( np * sizeof ( int ) );
+  nb->start = ( int * ) malloc ( ( np + 1 ) * sizeof ( int ) );
+  nb->list_max = 0;
+  nb->list = NULL;
+  nb->ps = ( double * ) malloc ( 3 * np * sizeof ( double ) );
+  nb->pos0 = ( double * ) malloc ( nd * np * sizeof ( double ) );
+  nb->rebuilds = 0;
+
+  return;
 }
 /******************************************************************************/
 
-void initialize ( int np, int nd, double pos[], double vel[], double acc[] )
+int neighbor_stale ( int np, int nd, double pos[], neighbor *nb )
 
 /******************************************************************************/
 /*
   Purpose:
 
-    INITIALIZE initializes the positions, velocities, and accelerations.
+    NEIGHBOR_STALE reports whether the Verlet neighbor list must be rebuilt.
+
+  Discussion:
+
+    Two particles can only have come within the range of the force
+    without appearing in each other's list once their displacements
+    since the last rebuild add up to more than the skin, which cannot
+    happen while every particle has moved less than half of it.
 
   Parameters:
 
@@ -262,43 +2217,110 @@ void initialize ( int np, int nd, double pos[], double vel[], double acc[] )
 
     Input, int ND, the number of spatial dimensions.
 
-    Output, double POS[ND*NP], the positions.
+    Input, double POS[NP*ND], the positions.
 
-    Output, double VEL[ND*NP], the velocities.
+    Input, neighbor *NB, the neighbor list.
 
-    Output, double ACC[ND*NP], the accelerations.
+    Output, int NEIGHBOR_STALE, is 1 if the list must be rebuilt.
 */
 {
+  double d;
+  double dr;
   int i;
   int j;
-  int seed;
-/*
-  Set positions.
-*/
-  seed = 123456789;
-  r8mat_uniform_ab ( nd, np, 0.0, 10.0, &seed, pos );
-/*
-  Set velocities.
-*/
-  for ( j = 0; j < np; j++ )
+  double limit;
+
+  if ( nb->rebuilds == 0 )
   {
-    for ( i = 0; i < nd; i++ )
-    {
-      vel[i+j*nd] = 0.0;
-    }
+    return 1;
   }
-/*
-  Set accelerations.
-*/
+
+  limit = 0.25 * nb->skin * nb->skin;
+
   for ( j = 0; j < np; j++ )
   {
+    d = 0.0;
     for ( i = 0; i < nd; i++ )
     {
-      acc[i+j*nd] = 0.0;
+      dr = pos[j+i*np] - nb->pos0[j+i*np];
+      d = d + dr * dr;
+    }
+    if ( limit <= d )
+    {
+      return 1;
     }
   }
 
-  return;
+  return 0;
+}
+/******************************************************************************/
+
+# pragma omp declare simd notinbranch
+double pair_p ( double r2 )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    PAIR_P evaluates sin(d)/d as a polynomial in d^2.
+
+  Discussion:
+
+    The Taylor series is truncated after the D^18 term, which leaves an
+    error of a couple of units in the last place for 0 <= D <= PI/2,
+    the only range the potential needs.  Unlike SIN, the polynomial
+    vectorizes, and it needs neither the square root of R2 nor a
+    division by D.
+
+  Parameters:
+
+    Input, double R2, the square of the distance D, at most (PI/2)^2.
+
+    Output, double PAIR_P, the value of sin(D)/D.
+*/
+{
+  return 1.0 + r2 * ( - 1.0 / 6.0
+             + r2 * ( 1.0 / 120.0
+             + r2 * ( - 1.0 / 5040.0
+             + r2 * ( 1.0 / 362880.0
+             + r2 * ( - 1.0 / 39916800.0
+             + r2 * ( 1.0 / 6227020800.0
+             + r2 * ( - 1.0 / 1307674368000.0
+             + r2 * ( 1.0 / 355687428096000.0
+             + r2 * ( - 1.0 / 121645100408832000.0 ) ) ) ) ) ) ) ) );
+}
+/******************************************************************************/
+
+# pragma omp declare simd notinbranch
+double pair_q ( double r2 )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    PAIR_Q evaluates cos(d) as a polynomial in d^2.
+
+  Discussion:
+
+    The Taylor series is truncated after the D^20 term, see PAIR_P.
+
+  Parameters:
+
+    Input, double R2, the square of the distance D, at most (PI/2)^2.
+
+    Output, double PAIR_Q, the value of cos(D).
+*/
+{
+  return 1.0 + r2 * ( - 1.0 / 2.0
+             + r2 * ( 1.0 / 24.0
+             + r2 * ( - 1.0 / 720.0
+             + r2 * ( 1.0 / 40320.0
+             + r2 * ( - 1.0 / 3628800.0
+             + r2 * ( 1.0 / 479001600.0
+             + r2 * ( - 1.0 / 87178291200.0
+             + r2 * ( 1.0 / 20922789888000.0
+             + r2 * ( - 1.0 / 6402373705728000.0
+             + r2 * ( 1.0 / 2432902008176640000.0 ) ) ) ) ) ) ) ) ) );
 }
 /******************************************************************************/
 
@@ -320,6 +2342,11 @@ void r8mat_uniform_ab ( int m, int n, double a, double b, int *seed, double r[]
     The integer arithmetic never requires more than 32 bits,
     including a sign bit.
 
+    The entries are filled in parallel.  Each thread jumps the seed
+    ahead to the start of its block with LCG_SKIP and runs the
+    recursion from there, so the matrix is the same whatever the
+    number of threads.
+
   Parameters:
 
     Input, int M, N, the number of rows and columns.
@@ -333,10 +2360,13 @@ void r8mat_uniform_ab ( int m, int n, double a, double b, int *seed, double r[]
     Output, double R[M*N], a matrix of pseudorandom values.
 */
 {
-  int i;
+  long long e;
+  long long e_hi;
   const int i4_huge = 2147483647;
-  int j;
   int k;
+  long long mn;
+  int s;
+  int t;
 
   if ( *seed == 0 )
   {
@@ -346,22 +2376,32 @@ void r8mat_uniform_ab ( int m, int n, double a, double b, int *seed, double r[]
     exit ( 1 );
   }
 
-  for ( j = 0; j < n; j++ )
+  mn = ( long long ) m * ( long long ) n;
+
+# pragma omp parallel default ( shared ) private ( e, e_hi, k, s, t )
   {
-    for ( i = 0; i < m; i++ )
+    t = omp_get_thread_num ( );
+    e = mn * t / omp_get_num_threads ( );
+    e_hi = mn * ( t + 1 ) / omp_get_num_threads ( );
+
+    s = lcg_skip ( *seed, e );
+
+    for ( ; e < e_hi; e++ )
     {
-      k = *seed / 127773;
+      k = s / 127773;
 
-      *seed = 16807 * ( *seed - k * 127773 ) - k * 2836;
+      s = 16807 * ( s - k * 127773 ) - k * 2836;
 
-      if ( *seed < 0 )
+      if ( s < 0 )
       {
-        *seed = *seed + i4_huge;
+        s = s + i4_huge;
       }
-      r[i+j*m] = a + ( b - a ) * ( double ) ( *seed ) * 4.656612875E-10;
+      r[e] = a + ( b - a ) * ( double ) ( s ) * 4.656612875E-10;
     }
   }
 
+  *seed = lcg_skip ( *seed, mn );
+
   return;
 }
 
@@ -390,13 +2430,13 @@ void update ( int np, int nd, double pos[], double vel[], double f[],
 
     Input, int ND, the number of spatial dimensions.
 
-    Input/output, double POS[ND*NP], the positions.
+    Input/output, double POS[NP*ND], the positions.
 
-    Input/output, double VEL[ND*NP], the velocities.
+    Input/output, double VEL[NP*ND], the velocities.
 
-    Input, double F[ND*NP], the forces.
+    Input, double F[NP*ND], the forces.
 
-    Input/output, double ACC[ND*NP], the accelerations.
+    Input/output, double ACC[NP*ND], the accelerations.
 
     Input, double MASS, the mass.
 
@@ -404,21 +2444,73 @@ void update ( int np, int nd, double pos[], double vel[], double f[],
 */
 {
   int i;
-  int j;
   double rmass;
 
   rmass = 1.0 / mass;
 
-  for ( j = 0; j < np; j++ )
+# pragma omp parallel for simd
+  for ( i = 0; i < nd * np; i++ )
   {
-    for ( i = 0; i < nd; i++ )
-    {
-      pos[i+j*nd] = pos[i+j*nd] + vel[i+j*nd] * dt + 0.5 * acc[i+j*nd] * dt * dt;
-      vel[i+j*nd] = vel[i+j*nd] + 0.5 * dt * ( f[i+j*nd] * rmass + acc[i+j*nd] );
-      acc[i+j*nd] = f[i+j*nd] * rmass;
-    }
+    pos[i] = pos[i] + vel[i] * dt + 0.5 * acc[i] * dt * dt;
+    vel[i] = vel[i] + 0.5 * dt * ( f[i] * rmass + acc[i] );
+    acc[i] = f[i] * rmass;
   }
 
   return;
 }
+/******************************************************************************/
+
+double update_fused ( int np, int nd, double pos[], double vel[], double f[], 
+  double acc[], double mass, double dt )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    UPDATE_FUSED updates the particles and returns the kinetic energy.
+
+  Discussion:
+
+    This is UPDATE with the kinetic energy of the new velocities
+    accumulated in the same pass, so that the force evaluation need
+    not stream the velocities again.
+
+  Parameters:
+
+    Input, int NP, the number of particles.
+
+    Input, int ND, the number of spatial dimensions.
+
+    Input/output, double POS[NP*ND], the positions.
+
+    Input/output, double VEL[NP*ND], the velocities.
+
+    Input, double F[NP*ND], the forces.
+
+    Input/output, double ACC[NP*ND], the accelerations.
+
+    Input, double MASS, the mass.
+
+    Input, double DT, the time step.
+
+    Output, double UPDATE_FUSED, the total kinetic energy.
+*/
+{
+  int i;
+  double ki;
+  double rmass;
+
+  rmass = 1.0 / mass;
+  ki = 0.0;
 
+# pragma omp parallel for simd reduction ( + : ki )
+  for ( i = 0; i < nd * np; i++ )
+  {
+    pos[i] = pos[i] + vel[i] * dt + 0.5 * acc[i] * dt * dt;
+    vel[i] = vel[i] + 0.5 * dt * ( f[i] * rmass + acc[i] );
+    acc[i] = f[i] * rmass;
+    ki = ki + vel[i] * vel[i];
+  }
+
+  return ki * 0.5 * mass;
+}
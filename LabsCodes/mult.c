@@ -1,43 +1,91 @@
 #include <stdio.h>
-/* Program for multiplication of D=A*B and E= A*C */
+#include <stdlib.h>
+#include <unistd.h>
+#include "gemm.h"
+/* Program for multiplication of D=A*B */
+/*
+   Usage: mult [-r levels] [nra [nca [ncb]]], 800 x 800 x 800 by
+   default.  A single size makes all the matrices square.
 
-#define NRA 800 		/* number of rows in matrix A */
-#define NCA 800        	/* number of columns in matrix A */
-#define NCB 800		/* number of columns in matrix B */
+   -r uses the recursive, task parallel multiply of gemm.h, with up to
+   LEVELS Strassen levels on large blocks, instead of the tiled one.
 
-int main()
+   The matrices are cache line aligned heap arrays, stored by rows, and
+   are initialized by a static parallel loop over the rows so that each
+   page is first touched, and placed, by the thread that will use it.
+*/
+
+#define NRA 800 		/* default number of rows in matrix A */
+#define NCA 800        	/* default number of columns in matrix A */
+#define NCB 800		/* default number of columns in matrix B */
+
+int main(int argc, char *argv[])
 {
-int    i, j, k;			/* misc */
-double a[NRA][NCA], 		/* matrix A to be multiplied */
-       b[NCA][NCB],      	/* matrix B to be multiplied */
-       d[NRA][NCB];      	/* result matrix A*B */
+int    i, j;			/* misc */
+int    opt;
+int    levels = -1;		/* Strassen levels for -r, -1 if tiled */
+int    nra = NRA,		/* number of rows in matrix A */
+       nca = NCA,		/* number of columns in matrix A */
+       ncb = NCB;		/* number of columns in matrix B */
+double *a, 			/* matrix A to be multiplied */
+       *b,      		/* matrix B to be multiplied */
+       *d;      		/* result matrix A*B */
+
 
+   while ((opt = getopt(argc, argv, "r:")) != -1) {
+      if (opt == 'r')
+         levels = atoi(optarg);
+      else
+         levels = -2;
+   }
+   if (argc > optind) nra = nca = ncb = atoi(argv[optind]);
+   if (argc > optind + 1) nca = atoi(argv[optind + 1]);
+   if (argc > optind + 2) ncb = atoi(argv[optind + 2]);
+   if (nra < 1 || nca < 1 || ncb < 1 || levels < -1) {
+      fprintf(stderr, "usage: %s [-r levels] [nra [nca [ncb]]]\n", argv[0]);
+      return 1;
+   }
+
+   a = gemm_alloc((size_t) nra * nca);
+   b = gemm_alloc((size_t) nca * ncb);
+   d = gemm_alloc((size_t) nra * ncb);
+   if (a == NULL || b == NULL || d == NULL) {
+      fprintf(stderr, "%s: cannot allocate the matrices\n", argv[0]);
+      return 1;
+   }
 
    /* Initialize A, B, D*/
-   for (i=0; i< NRA; i++)
-      for (j=0; j< NCA; j++)
-         a[i][j]= 1.;
-   for (i=0; i< NCA; i++)
-      for (j=0; j< NCB; j++)
-         b[i][j]= 1.;
+#pragma omp parallel for private(j) schedule(static)
+   for (i=0; i< nra; i++)
+      for (j=0; j< nca; j++)
+         a[(size_t) i*nca + j]= 1.;
+#pragma omp parallel for private(j) schedule(static)
+   for (i=0; i< nca; i++)
+      for (j=0; j< ncb; j++)
+         b[(size_t) i*ncb + j]= 1.;
 
-   for(i=0;i< NRA;i++)
-      for(j=0;j< NCB;j++)
-         d[i][j] = 0.0;
+#pragma omp parallel for private(j) schedule(static)
+   for(i=0;i< nra;i++)
+      for(j=0;j< ncb;j++)
+         d[(size_t) i*ncb + j] = 0.0;
 
 
 
    /* Perform matrix multiply A.B */
-   for(i=0;i< NRA;i++)
-      for(j=0;j< NCB;j++)
-         for(k=0;k< NCA;k++)
-            d[i][j]+= a[i][k] * b[k][j];
+   if (levels < 0)
+      gemm(nra, ncb, nca, a, nca, b, ncb, d, ncb);
+   else
+      gemm_tasks(nra, ncb, nca, a, nca, b, ncb, d, ncb, levels);
 
 
    printf("Done\n");
 
-   printf("d[0][0]= %f\n ", d[0][0]);
-   printf("d[NRA-1][NCB-1]= %f\n ", d[NRA-1][NCB-1]);
+   printf("d[0][0]= %f\n ", d[0]);
+   printf("d[NRA-1][NCB-1]= %f\n ", d[(size_t) nra*ncb - 1]);
    printf ("\n");
-}
 
+   free(a);
+   free(b);
+   free(d);
+   return 0;
+}
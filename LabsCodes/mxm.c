@@ -1,61 +1,140 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "gemm.h"
 /* Program for multiplication of D=A*B and E= A*C */
+/*
+   Usage: mxm [-s] [-r levels] [nra [nca [ncb [ncc]]]], 600 x 600 x
+   600 x 600 by default.  A single size makes all the matrices square.
 
-#define NRA 600 		/* number of rows in matrix A */
-#define NCA 600        	/* number of columns in matrix A */
-#define NCB 600		/* number of columns in matrix B */
-#define NCC 600		/* number of columns in matrix C */
+   B and C are stored side by side as the column blocks of [B|C], and
+   D and E as those of [D|E].  By default both products are computed in
+   one pass over A, as [D|E] = A*[B|C], so A is read from memory once.
+   "mxm -s" computes them separately.
 
-main()
+   -r uses the recursive, task parallel multiply of gemm.h, with up to
+   LEVELS Strassen levels on large blocks, instead of the tiled one.
+
+   The matrices are cache line aligned heap arrays, stored by rows, and
+   are initialized by a static parallel loop over the rows so that each
+   page is first touched, and placed, by the thread that will use it.
+*/
+
+#define NRA 600 		/* default number of rows in matrix A */
+#define NCA 600        	/* default number of columns in matrix A */
+#define NCB 600		/* default number of columns in matrix B */
+#define NCC 600		/* default number of columns in matrix C */
+
+int main(int argc, char *argv[])
 {
-int    i, j, k;			/* misc */
-double a[NRA][NCA], 		/* matrix A to be multiplied */
-       b[NCA][NCB],      	/* matrix B to be multiplied */
-       c[NCA][NCC],		/* matrix C to be multiplied */
-       d[NRA][NCB],      	/* result matrix A*B */
-       e[NRA][NCC];		/* result matrix A*C */
+int    i, j;			/* misc */
+int    arg;			/* next command line argument */
+int    opt;
+int    fused = 1;		/* one pass over A for both products */
+int    levels = -1;		/* Strassen levels for -r, -1 if tiled */
+int    nra = NRA,		/* number of rows in matrix A */
+       nca = NCA,		/* number of columns in matrix A */
+       ncb = NCB,		/* number of columns in matrix B */
+       ncc = NCC,		/* number of columns in matrix C */
+       ldbc;			/* row length of [B|C] and [D|E] */
+double *a, 			/* matrix A to be multiplied */
+       *bc,			/* [B|C], nca x (ncb+ncc) */
+       *de,			/* [D|E], nra x (ncb+ncc) */
+       *b,      		/* matrix B to be multiplied, in bc */
+       *c,			/* matrix C to be multiplied, in bc */
+       *d,      		/* result matrix A*B, in de */
+       *e;			/* result matrix A*C, in de */
+
 
+   while ((opt = getopt(argc, argv, "sr:")) != -1) {
+      if (opt == 's')
+         fused = 0;
+      else if (opt == 'r')
+         levels = atoi(optarg);
+      else
+         levels = -2;
+   }
+   arg = optind;
+   if (argc > arg) nra = nca = ncb = ncc = atoi(argv[arg++]);
+   if (argc > arg) nca = atoi(argv[arg++]);
+   if (argc > arg) ncb = atoi(argv[arg++]);
+   if (argc > arg) ncc = atoi(argv[arg++]);
+   if (nra < 1 || nca < 1 || ncb < 1 || ncc < 1 || levels < -1) {
+      fprintf(stderr, "usage: %s [-s] [-r levels] [nra [nca [ncb [ncc]]]]\n",
+              argv[0]);
+      return 1;
+   }
+   ldbc = ncb + ncc;
+
+   a = gemm_alloc((size_t) nra * nca);
+   bc = gemm_alloc((size_t) nca * ldbc);
+   de = gemm_alloc((size_t) nra * ldbc);
+   if (a == NULL || bc == NULL || de == NULL) {
+      fprintf(stderr, "%s: cannot allocate the matrices\n", argv[0]);
+      return 1;
+   }
+   b = bc;
+   c = bc + ncb;
+   d = de;
+   e = de + ncb;
 
    /* Initialize A, B, C, D and E matrices */
-   for (i=0; i< NRA; i++)
-      for (j=0; j< NCA; j++)
-         a[i][j]= 1.;
-   for (i=0; i< NCA; i++)
-      for (j=0; j< NCB; j++)
-         b[i][j]= 1.;
-   for (i=0; i< NCA; i++)
-      for (j=0; j< NCC; j++)
-         c[i][j]= 2.;
+#pragma omp parallel for private(j) schedule(static)
+   for (i=0; i< nra; i++)
+      for (j=0; j< nca; j++)
+         a[(size_t) i*nca + j]= 1.;
+#pragma omp parallel for private(j) schedule(static)
+   for (i=0; i< nca; i++) {
+      for (j=0; j< ncb; j++)
+         b[(size_t) i*ldbc + j]= 1.;
+      for (j=0; j< ncc; j++)
+         c[(size_t) i*ldbc + j]= 2.;
+   }
 
-   for(i=0;i< NRA;i++)
-      for(j=0;j< NCB;j++)
-         d[i][j] = 0.0;
-   for(i=0;i< NRA;i++)
-      for(j=0;j< NCC;j++)
-         e[i][j] = 0.0;
+#pragma omp parallel for private(j) schedule(static)
+   for(i=0;i< nra;i++) {
+      for(j=0;j< ncb;j++)
+         d[(size_t) i*ldbc + j] = 0.0;
+      for(j=0;j< ncc;j++)
+         e[(size_t) i*ldbc + j] = 0.0;
+   }
 
 
 
-   /* Perform matrix multiply A.B */
-   for(i=0;i< NRA;i++)
-      for(j=0;j< NCB;j++)
-         for(k=0;k< NCA;k++)
-            d[i][j]+= a[i][k] * b[k][j];
+   if (fused && levels >= 0) {
+      /* Perform matrix multiply A.[B|C] */
+      gemm_tasks(nra, ldbc, nca, a, nca, bc, ldbc, de, ldbc, levels);
+   }
+   else if (fused) {
+      gemm(nra, ldbc, nca, a, nca, bc, ldbc, de, ldbc);
+   }
+   else if (levels >= 0) {
+      /* Perform matrix multiply A.B */
+      gemm_tasks(nra, ncb, nca, a, nca, b, ldbc, d, ldbc, levels);
 
+      /* Perform matrix multiply A.C */
+      gemm_tasks(nra, ncc, nca, a, nca, c, ldbc, e, ldbc, levels);
+   }
+   else {
+      /* Perform matrix multiply A.B */
+      gemm(nra, ncb, nca, a, nca, b, ldbc, d, ldbc);
 
-   /* Perform matrix multiply A.C */
-   for(i=0;i< NRA;i++)
-      for(j=0;j< NCC;j++)
-         for(k=0;k< NCA;k++)
-            e[i][j]+= a[i][k] * c[k][j];
+      /* Perform matrix multiply A.C */
+      gemm(nra, ncc, nca, a, nca, c, ldbc, e, ldbc);
+   }
 
 
    printf("Done\n");
 
-   printf("d[0][0]= %f\n ", d[0][0]);
-   printf("d[NRA-1][NCB-1]= %f\n ", d[NRA-1][NCB-1]);
-   printf("e[0][0]= %f\n ", e[0][0]);
-   printf("e[NRA-1][NCC-1]= %f\n ", e[NRA-1][NCC-1]);
+   printf("d[0][0]= %f\n ", d[0]);
+   printf("d[NRA-1][NCB-1]= %f\n ", d[(size_t) (nra-1)*ldbc + ncb-1]);
+   printf("e[0][0]= %f\n ", e[0]);
+   printf("e[NRA-1][NCC-1]= %f\n ", e[(size_t) (nra-1)*ldbc + ncc-1]);
    printf ("\n");
-}
 
+   free(a);
+   free(bc);
+   free(de);
+   return 0;
+}
@@ -1,24 +1,93 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
+#include <omp.h>
 
-int main()
+/*
+   Usage: pi [n], 1000000000 points by default.
+
+   Midpoint rule for the integral of 4/(1+x^2) over [0,1].  The points
+   are split over the threads in blocks of BLOCK; each block is summed
+   by a simd reduction, and the block sums are added to a per-thread
+   compensated (Kahan) sum, so the rounding error does not grow with n
+   or with the number of threads.  The thread sums are then added in
+   thread order, also compensated.
+
+   Do not build with -ffast-math, which drops the compensation.
+*/
+
+#define BLOCK 4096
+#define FLOPS 6		/* per point: 2 for x, x*x, 1+, 4/, sum */
+
+int main(int argc, char *argv[])
 {
 
-  double w,x,sum,pi,f,a;
-  int n,i;
+  double w,pi,t,sum,c,y,s;
+  double *part, *comp;
+  long n,nb,b;
+  int nt,i;
 
   n=1000000000;
+  if (argc > 1) n=atol(argv[1]);
+  if (n < 1) {
+    fprintf(stderr, "usage: %s [n]\n", argv[0]);
+    return 1;
+  }
 
   w=1.0/n;
-  sum=0.0;
+  nb=(n+BLOCK-1)/BLOCK;
+  nt=omp_get_max_threads();
+  part=calloc(nt, sizeof(double));
+  comp=calloc(nt, sizeof(double));
+
+  t=omp_get_wtime();
+#pragma omp parallel private(b,sum,c,y,s)
+  {
+    int id=omp_get_thread_num();
+    long lo,hi;
+    double x,base;
+    int j;
+
+    sum=0.0;
+    c=0.0;
+#pragma omp for schedule(static)
+    for(b=0;b<nb;b++){
+      lo=b*BLOCK;
+      hi=lo+BLOCK < n ? lo+BLOCK : n;
+      base=(double) lo;
+      s=0.0;
+#pragma omp simd private(x) reduction(+:s)
+      for(j=0;j<(int) (hi-lo);j++){
+        x=w*(base+(j+0.5));
+        s=s+4.0/(1.0+x*x);
+      }
 
-  for(i=0;i<n;i++){
-     x=w*(i-0.5);
-     sum=sum+4.0/(1.0+x*x);
+      /* Kahan: c keeps the low order bits lost from sum */
+      y=s-c;
+      s=sum+y;
+      c=(s-sum)-y;
+      sum=s;
+    }
+    part[id]=sum;
+    comp[id]=c;
   }
 
+  sum=0.0;
+  c=0.0;
+  for(i=0;i<nt;i++){
+    y=part[i]-(comp[i]+c);
+    s=sum+y;
+    c=(s-sum)-y;
+    sum=s;
+  }
   pi=w*sum;
+  t=omp_get_wtime()-t;
 
   printf("pi=%f\n", pi);
+  printf("error=%e, %d threads, %f s, %.2f GFLOP/s\n", pi-M_PI, nt, t,
+         FLOPS*(double) n/t*1e-9);
 
+  free(part);
+  free(comp);
+  return 0;
 }
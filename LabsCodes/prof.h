@@ -0,0 +1,412 @@
+/*
+  prof.h - named region timers for the lab programs.
+
+  Built with -DPROF,
+
+     PROF_BEGIN ( "name" );  ...  PROF_END ( "name" );
+
+  adds the time the calling thread spends between the two to the region
+  NAME, for each OpenMP thread separately, and PROF_BARRIER ( "name" )
+  is an omp barrier whose waiting time is recorded as the region NAME.
+  They may be used inside or outside parallel regions, and regions may
+  nest, but a thread must END a region before it BEGINs it again.  The
+  name is looked up once per call site, under a critical section, and
+  the first look up registers the report with atexit.
+
+  At exit the regions are written as JSON to the file named by the
+  environment variable PROF_OUT, prof.json by default, or to stderr if
+  PROF_OUT is "-": for each region the calls and seconds of every thread
+  that entered it, and the total, max and mean over those threads.  max
+  over mean is the load imbalance of the region.
+
+  -DPROF_PAPI (link -lpapi) also counts, per region and thread, the
+  PAPI presets in prof_event below that the machine has: cycles, L1
+  data and L3 misses, double precision operations.
+
+  -DPROF_OMPT registers an OMPT tool that adds up, per native thread,
+  the time spent waiting in barriers, taskwaits, taskgroups and
+  reductions, reported as "ompt".  libgomp has no OMPT, so with gcc the
+  program has to run on a runtime that has, LLVM's libomp, by linking
+  it or, if ompt_start_tool is exported (-rdynamic), by preloading it:
+
+     gcc -fopenmp -DPROF -DPROF_OMPT -I<omp-tools.h dir> ... -L<llvm>/lib -lomp
+     LD_PRELOAD=<llvm>/lib/libomp.so ./prog
+
+  Without -DPROF, PROF_BEGIN and PROF_END expand to nothing and
+  PROF_BARRIER to a plain barrier.
+
+  Include it in one translation unit; everything is static, except
+  ompt_start_tool with -DPROF_OMPT.
+*/
+#ifndef PROF_H
+#define PROF_H
+
+#include <omp.h>
+
+static inline void prof_barrier ( void )
+{
+#pragma omp barrier
+}
+
+#ifndef PROF
+
+#define PROF_BEGIN(name) ((void) 0)
+#define PROF_END(name) ((void) 0)
+#define PROF_BARRIER(name) prof_barrier ( )
+
+#else
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef PROF_MAX_REGIONS
+#define PROF_MAX_REGIONS 32
+#endif
+#ifndef PROF_MAX_THREADS
+#define PROF_MAX_THREADS 256
+#endif
+
+#ifdef PROF_PAPI
+#include <pthread.h>
+#include <papi.h>
+
+#define PROF_NEVENT 4
+
+static const char *prof_event[PROF_NEVENT] = {
+   "PAPI_TOT_CYC", "PAPI_L1_DCM", "PAPI_L3_TCM", "PAPI_DP_OPS"
+};
+static int prof_event_code[PROF_NEVENT], prof_nevent;
+
+/* The event set of each thread, created on its first PROF_BEGIN */
+static int prof_evset = -1;
+#pragma omp threadprivate(prof_evset)
+#endif
+
+/*
+  One slot per region and thread, each in its own cache lines, so that
+  the threads never write to the same line.
+*/
+typedef struct {
+   double start;
+   double seconds;
+   long calls;
+#ifdef PROF_PAPI
+   long long count0[PROF_NEVENT];
+   long long count[PROF_NEVENT];
+#endif
+} __attribute__ ((aligned (64))) prof_slot;
+
+static const char *prof_name[PROF_MAX_REGIONS];
+static int prof_nregion;
+static prof_slot prof_table[PROF_MAX_REGIONS][PROF_MAX_THREADS];
+
+static void prof_report ( void );
+
+/*
+  The region NAME, created if new; -1 once PROF_MAX_REGIONS are in
+  use, and the region is then not timed.
+*/
+static int prof_region ( const char *name )
+{
+   int r;
+
+#pragma omp critical (prof)
+   {
+      for ( r = 0; r < prof_nregion; r++ )
+         if ( strcmp ( prof_name[r], name ) == 0 )
+            break;
+      if ( r == prof_nregion )
+      {
+         if ( r == PROF_MAX_REGIONS )
+         {
+            fprintf ( stderr, "prof: more than %d regions, %s not timed\n",
+                      PROF_MAX_REGIONS, name );
+            r = -1;
+         }
+         else
+         {
+            if ( r == 0 )
+            {
+               atexit ( prof_report );
+#ifdef PROF_PAPI
+               if ( PAPI_library_init ( PAPI_VER_CURRENT ) == PAPI_VER_CURRENT &&
+                    PAPI_thread_init ( ( unsigned long ( * ) ( void ) ) pthread_self ) == PAPI_OK )
+               {
+                  int e;
+
+                  for ( e = 0; e < PROF_NEVENT; e++ )
+                     if ( PAPI_event_name_to_code ( ( char * ) prof_event[e], &prof_event_code[prof_nevent] ) == PAPI_OK &&
+                          PAPI_query_event ( prof_event_code[prof_nevent] ) == PAPI_OK )
+                        prof_event[prof_nevent++] = prof_event[e];
+               }
+               else
+                  fprintf ( stderr, "prof: PAPI not available, no counters\n" );
+#endif
+            }
+            prof_name[r] = name;
+            prof_nregion = r + 1;
+         }
+      }
+   }
+   return r;
+}
+
+/* The calling thread's slot of region R, NULL if it is not timed */
+static inline prof_slot *prof_slot_of ( int r )
+{
+   int id = omp_get_thread_num ( );
+
+   if ( r < 0 || id >= PROF_MAX_THREADS )
+      return NULL;
+   return &prof_table[r][id];
+}
+
+#ifdef PROF_PAPI
+/* Reads the thread's counters into V, starting them if needed */
+static int prof_read ( long long v[] )
+{
+   int e;
+
+   if ( prof_nevent == 0 )
+      return 0;
+   if ( prof_evset == -1 )
+   {
+      int set = PAPI_NULL;
+
+      prof_evset = -2;
+      if ( PAPI_create_eventset ( &set ) != PAPI_OK )
+         return 0;
+      for ( e = 0; e < prof_nevent; e++ )
+         if ( PAPI_add_event ( set, prof_event_code[e] ) != PAPI_OK )
+            return 0;
+      if ( PAPI_start ( set ) != PAPI_OK )
+         return 0;
+      prof_evset = set;
+   }
+   return prof_evset >= 0 && PAPI_read ( prof_evset, v ) == PAPI_OK;
+}
+#endif
+
+static inline void prof_begin ( int r )
+{
+   prof_slot *s = prof_slot_of ( r );
+
+   if ( s == NULL )
+      return;
+#ifdef PROF_PAPI
+   if ( !prof_read ( s->count0 ) )
+      memset ( s->count0, 0, sizeof ( s->count0 ) );
+#endif
+   s->start = omp_get_wtime ( );
+}
+
+static inline void prof_end ( int r )
+{
+   double t = omp_get_wtime ( );
+   prof_slot *s = prof_slot_of ( r );
+
+   if ( s == NULL )
+      return;
+   s->seconds += t - s->start;
+   s->calls++;
+#ifdef PROF_PAPI
+   {
+      long long v[PROF_NEVENT];
+      int e;
+
+      if ( prof_read ( v ) )
+         for ( e = 0; e < prof_nevent; e++ )
+            s->count[e] += v[e] - s->count0[e];
+   }
+#endif
+}
+
+/*
+  Each call site keeps the number of its region in a static, read and
+  written atomically since the first calls may come from several
+  threads at once.
+*/
+#define PROF_ID_(name, r) \
+   static int prof_id_ = -1; \
+   int r; \
+   _Pragma ( "omp atomic read" ) \
+   r = prof_id_; \
+   if ( r < 0 ) \
+   { \
+      r = prof_region ( name ); \
+      _Pragma ( "omp atomic write" ) \
+      prof_id_ = r; \
+   }
+
+#define PROF_BEGIN(name) \
+   do { PROF_ID_ ( name, prof_r_ ) prof_begin ( prof_r_ ); } while ( 0 )
+#define PROF_END(name) \
+   do { PROF_ID_ ( name, prof_r_ ) prof_end ( prof_r_ ); } while ( 0 )
+#define PROF_BARRIER(name) \
+   do { PROF_ID_ ( name, prof_r_ ) prof_begin ( prof_r_ ); \
+        prof_barrier ( ); prof_end ( prof_r_ ); } while ( 0 )
+
+#ifdef PROF_OMPT
+#include <time.h>
+#include <omp-tools.h>
+
+#define PROF_NSYNC 4
+
+static const char *prof_sync_name[PROF_NSYNC] = {
+   "barrier", "taskwait", "taskgroup", "reduction"
+};
+/* Seconds waited per thread and kind, a cache line per thread */
+static double prof_wait[PROF_MAX_THREADS][PROF_NSYNC + 4] __attribute__ ((aligned (64)));
+static int prof_ompt_on, prof_ompt_threads;
+static __thread int prof_ompt_id = -1;
+static __thread double prof_ompt_t0;
+
+/* The OMPT callbacks run inside the runtime, so they time with
+   clock_gettime rather than omp_get_wtime */
+static double prof_ompt_clock ( void )
+{
+   struct timespec ts;
+
+   clock_gettime ( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static void prof_ompt_wait ( ompt_sync_region_t kind,
+   ompt_scope_endpoint_t endpoint, ompt_data_t *parallel_data,
+   ompt_data_t *task_data, const void *codeptr_ra )
+{
+   int k;
+
+   if ( prof_ompt_id < 0 )
+      prof_ompt_id = __atomic_fetch_add ( &prof_ompt_threads, 1, __ATOMIC_RELAXED );
+   if ( prof_ompt_id >= PROF_MAX_THREADS )
+      return;
+   if ( endpoint == ompt_scope_begin )
+   {
+      prof_ompt_t0 = prof_ompt_clock ( );
+      return;
+   }
+
+   if ( kind == ompt_sync_region_taskwait )
+      k = 1;
+   else if ( kind == ompt_sync_region_taskgroup )
+      k = 2;
+   else if ( kind == ompt_sync_region_reduction )
+      k = 3;
+   else
+      k = 0;
+   prof_wait[prof_ompt_id][k] += prof_ompt_clock ( ) - prof_ompt_t0;
+}
+
+static int prof_ompt_init ( ompt_function_lookup_t lookup,
+   int initial_device_num, ompt_data_t *tool_data )
+{
+   ompt_set_callback_t set = ( ompt_set_callback_t ) lookup ( "ompt_set_callback" );
+
+   if ( set != NULL &&
+        set ( ompt_callback_sync_region_wait, ( ompt_callback_t ) prof_ompt_wait ) == ompt_set_always )
+      prof_ompt_on = 1;
+   return 1;
+}
+
+static void prof_ompt_fini ( ompt_data_t *tool_data )
+{
+}
+
+ompt_start_tool_result_t *ompt_start_tool ( unsigned int omp_version,
+   const char *runtime_version )
+{
+   static ompt_start_tool_result_t tool = { prof_ompt_init, prof_ompt_fini, { 0 } };
+
+   return &tool;
+}
+#endif
+
+static void prof_report ( void )
+{
+   const char *path = getenv ( "PROF_OUT" );
+   FILE *out;
+   int r, i, n;
+
+   if ( path == NULL || *path == '\0' )
+      path = "prof.json";
+   if ( strcmp ( path, "-" ) == 0 )
+      out = stderr;
+   else if ( ( out = fopen ( path, "w" ) ) == NULL )
+   {
+      fprintf ( stderr, "prof: cannot write %s\n", path );
+      return;
+   }
+
+   fprintf ( out, "{\n  \"threads\": %d,\n  \"regions\": [", omp_get_max_threads ( ) );
+   for ( r = 0; r < prof_nregion; r++ )
+   {
+      double total = 0.0, max = 0.0;
+      long calls = 0;
+
+      n = 0;
+      for ( i = 0; i < PROF_MAX_THREADS; i++ )
+      {
+         prof_slot *s = &prof_table[r][i];
+
+         if ( s->calls == 0 )
+            continue;
+         n++;
+         calls += s->calls;
+         total += s->seconds;
+         if ( s->seconds > max )
+            max = s->seconds;
+      }
+      fprintf ( out, "%s\n    {\"name\": \"%s\", \"calls\": %ld, \"total\": %.9f, "
+                "\"max\": %.9f, \"mean\": %.9f,\n     \"threads\": [",
+                r ? "," : "", prof_name[r], calls, total, max, n ? total / n : 0.0 );
+
+      n = 0;
+      for ( i = 0; i < PROF_MAX_THREADS; i++ )
+      {
+         prof_slot *s = &prof_table[r][i];
+
+         if ( s->calls == 0 )
+            continue;
+         fprintf ( out, "%s\n       {\"thread\": %d, \"calls\": %ld, \"seconds\": %.9f",
+                   n++ ? "," : "", i, s->calls, s->seconds );
+#ifdef PROF_PAPI
+         {
+            int e;
+
+            for ( e = 0; e < prof_nevent; e++ )
+               fprintf ( out, ", \"%s\": %lld", prof_event[e], s->count[e] );
+         }
+#endif
+         fprintf ( out, "}" );
+      }
+      fprintf ( out, "]}" );
+   }
+   fprintf ( out, "\n  ]" );
+
+#ifdef PROF_OMPT
+   if ( prof_ompt_on )
+   {
+      int k;
+
+      n = prof_ompt_threads < PROF_MAX_THREADS ? prof_ompt_threads : PROF_MAX_THREADS;
+      fprintf ( out, ",\n  \"ompt\": {" );
+      for ( k = 0; k < PROF_NSYNC; k++ )
+      {
+         fprintf ( out, "%s\n    \"%s\": [", k ? "," : "", prof_sync_name[k] );
+         for ( i = 0; i < n; i++ )
+            fprintf ( out, "%s%.9f", i ? ", " : "", prof_wait[i][k] );
+         fprintf ( out, "]" );
+      }
+      fprintf ( out, "\n  }" );
+   }
+#endif
+   fprintf ( out, "\n}\n" );
+   if ( out != stderr )
+      fclose ( out );
+}
+
+#endif
+
+#endif
@@ -1,30 +1,133 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <math.h>
+#include <omp.h>
 
-int main()
+/*
+   Usage: schedule [mode]
+
+   The second loop is triangular: row i does i*1000 iterations, so the
+   work of the first i rows grows as i^2.  It is run under each MODE,
+   or only under the one given:
+
+     static     block schedule, the default of omp for
+     cyclic     schedule(static,1)
+     dynamic    schedule(dynamic)
+     guided     schedule(guided)
+     balanced   thread t of T takes the rows from N*sqrt(t/T) to
+                N*sqrt((t+1)/T), blocks of equal work
+
+   and for each the time, the busy time of every thread (until it ran
+   out of rows) and the imbalance, the largest busy time over the mean,
+   are written.
+*/
+
+#define N 400
+#define NMODE 5
+
+float A[N][N], B[N][N];
+
+void kernel(int mode, double busy[]);
+
+int main(int argc, char *argv[])
 {
-    float A[400][400], tmp;
-    int i,j,k;
-    
-#pragma omp parallel shared(A), private(i,j,k,tmp)
+    char *name[NMODE] = {"static", "cyclic", "dynamic", "guided", "balanced"};
+    double t, *busy, max, mean;
+    int m, i, nt, first = -1, same = 1;
+
+    nt = omp_get_max_threads();
+    busy = malloc(sizeof(double) * nt);
+
+    for (m=0;m<NMODE;m++)
     {
-#pragma omp for
-        for(i=0;i<400;i++)
-            for(j=0;j<400;j++)
-                A[i][j]=i*j;
-        
-#pragma omp for
-        for(i=0;i<400;i++)
-            for(j=0;j<i;j++)
-                for(k=0;k<1000;k++)
-                {
-                    tmp=sqrt(pow(A[i][j],j));
-                    A[i][j]=pow(A[j][i],j)/i+tmp;
-                }
+        if (argc > 1 && strcmp(argv[1], name[m]) != 0)
+            continue;
+
+        for (i=0;i<nt;i++)
+            busy[i] = 0.0;
+        t = omp_get_wtime();
+        kernel(m, busy);
+        t = omp_get_wtime() - t;
+
+        max = mean = 0.0;
+        for (i=0;i<nt;i++){
+            mean += busy[i] / nt;
+            if (busy[i] > max)
+                max = busy[i];
+        }
+        printf("%-8s %9.6f s  imbalance %5.3f  busy", name[m], t, max / mean);
+        for (i=0;i<nt;i++)
+            printf(" %.4f", busy[i]);
+        printf("\n");
+
+        if (first < 0){
+            first = m;
+            memcpy(B, A, sizeof(A));
+        }
+        else if (memcmp(A, B, sizeof(A)) != 0)
+            same = 0;
     }
-    
+    if (first < 0){
+        fprintf(stderr, "usage: %s [static|cyclic|dynamic|guided|balanced]\n", argv[0]);
+        return 1;
+    }
+    if (!same)
+        printf("the schedules gave different results\n");
+
     printf("A[1][1]=%f,A[2][2]=%f,A[399][399]=%f\n",A[1][1],A[2][2],A[399][399]);
+    free(busy);
+    return 0;
 }
 
+/* The two loops of the original under schedule MODE; BUSY[t] gets the
+   time thread t spent in the triangular loop */
+void kernel(int mode, double busy[])
+{
+    float tmp;
+    int i,j,k;
+
+    if (mode == 0)
+        omp_set_schedule(omp_sched_static, 0);
+    else if (mode == 1)
+        omp_set_schedule(omp_sched_static, 1);
+    else if (mode == 2)
+        omp_set_schedule(omp_sched_dynamic, 1);
+    else if (mode == 3)
+        omp_set_schedule(omp_sched_guided, 0);
 
+#pragma omp parallel shared(A), private(i,j,k,tmp)
+    {
+        int id = omp_get_thread_num(), nt = omp_get_num_threads(), lo, hi;
+        double t0;
 
+#pragma omp for
+        for(i=0;i<N;i++)
+            for(j=0;j<N;j++)
+                A[i][j]=i*j;
+
+        t0 = omp_get_wtime();
+        if (mode < 4) {
+#pragma omp for schedule(runtime) nowait
+            for(i=0;i<N;i++)
+                for(j=0;j<i;j++)
+                    for(k=0;k<1000;k++)
+                    {
+                        tmp=sqrt(pow(A[i][j],j));
+                        A[i][j]=pow(A[j][i],j)/i+tmp;
+                    }
+        }
+        else {
+            lo = (int) (N * sqrt((double) id / nt));
+            hi = (int) (N * sqrt((double) (id + 1) / nt));
+            for(i=lo;i<hi;i++)
+                for(j=0;j<i;j++)
+                    for(k=0;k<1000;k++)
+                    {
+                        tmp=sqrt(pow(A[i][j],j));
+                        A[i][j]=pow(A[j][i],j)/i+tmp;
+                    }
+        }
+        busy[id] = omp_get_wtime() - t0;
+    }
+}
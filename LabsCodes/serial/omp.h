@@ -0,0 +1,48 @@
+/*
+   Stand-in for omp.h in the serial builds of the Makefile, which
+   compile the programs without -fopenmp and with this directory first
+   on the include path.  Only the routines the programs call are here:
+   one thread, and a monotonic clock for omp_get_wtime.
+*/
+
+#ifndef SERIAL_OMP_H
+#define SERIAL_OMP_H
+
+#include <time.h>
+
+typedef enum omp_sched_t {
+   omp_sched_static = 1,
+   omp_sched_dynamic = 2,
+   omp_sched_guided = 3,
+   omp_sched_auto = 4,
+   omp_sched_monotonic = (int) 0x80000000u
+} omp_sched_t;
+
+static omp_sched_t omp_stub_kind = omp_sched_static;
+static int omp_stub_chunk = 0;
+
+static inline int omp_get_thread_num(void) { return 0; }
+static inline int omp_get_num_threads(void) { return 1; }
+static inline int omp_get_max_threads(void) { return 1; }
+
+static inline void omp_set_schedule(omp_sched_t kind, int chunk)
+{
+   omp_stub_kind = kind;
+   omp_stub_chunk = chunk;
+}
+
+static inline void omp_get_schedule(omp_sched_t *kind, int *chunk)
+{
+   *kind = omp_stub_kind;
+   *chunk = omp_stub_chunk;
+}
+
+static inline double omp_get_wtime(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+#endif
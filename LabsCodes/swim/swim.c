@@ -27,34 +27,96 @@ C     Execution time is linear in ITMAX.*/
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
-
-#define N1 1335
-#define N2 1335
+#include <pthread.h>
+#include "../prof.h"
 
 #define min(a,b) (((a) < (b)) ? (a) : (b))
 
-float U[N1][N2], V[N1][N2], P[N1][N2], UNEW[N1][N2], VNEW[N1][N2], PNEW[N1][N2], UOLD[N1][N2], VOLD[N1][N2], POLD[N1][N2], CU[N1][N2], CV[N1][N2], Z[N1][N2], H[N1][N2], PSI[N1][N2];
+/*  The 14 arrays are carved out of one heap pool, sized from the M and
+    N of swim.in.  Rows are LD floats long, padded to whole cache lines,
+    and each array starts one cache line further into its slot of the
+    pool than the one before, so that the same point of two arrays does
+    not fall in the same cache set.
+
+    The three time levels of U, V and P are pointers, which the time
+    step rotates instead of copying the new values back.  The routines
+    index the arrays through local M+1 by LD views made by VIEW.*/
+
+#define NGRID 14
+#define VIEW(A, a) float (*restrict A)[LD] = (float (*)[LD]) (a)
 
-int  ITMAX, MPRINT, M, N, MP1, NP1;
+float *pool;
+float *u, *v, *p, *unew, *vnew, *pnew, *uold, *vold, *pold, *cu, *cv, *z, *h, *psi;
+
+int  ITMAX, MPRINT, M, N, MP1, NP1, LD;
 
 float DT,TDT,DX,DY,A,ALPHA,EL,PI,TPI,DI,DJ,PCF;
 
+/*  The checksums, summed in double by the threads of check*/
+
+double PCHECK, UCHECK, VCHECK;
+
+/*  SWIM7 is binary: a swim_header, then one swim_record per printed
+    cycle, each followed by NDIAG floats, the diagonal elements
+    UNEW[i][i] for i = 0, 10, 20, ... below min(M,N), and, when the
+    environment variable SWIM_SNAPSHOT is set to a nonzero value, by
+    the full M+1 by N+1 fields PNEW, UNEW and VNEW, stored by rows.*/
+
+typedef struct {
+    char magic[8];          /* "SWIMDIA1" */
+    int m, n;               /* M and N of swim.in */
+    int ndiag;              /* diagonal elements per record */
+    int snapshot;           /* 1 if the records hold the fields */
+} swim_header;
+
+typedef struct {
+    int ncycle;             /* the cycle number */
+    int pad;
+    double ptime;           /* model time in hours */
+    double pcheck, ucheck, vcheck;
+} swim_record;
+
+/*  Asynchronous SWIM7 writer.  A record is copied to BUF and written
+    by a background thread, so the time loop only waits if the record
+    of the previous print cycle is still being written.*/
+
+typedef struct {
+    FILE *fp;
+    swim_header h;
+    swim_record r;
+    float *buf;             /* the diagonal, then the fields */
+    size_t len;             /* floats of BUF per record */
+    pthread_t thread;
+    int busy;               /* 1 while the writer thread runs */
+    int error;              /* set by the writer thread if a write failed */
+} swim_writer;
+
 void initial(void);
 void calc1(void);
 void calc2(void);
 void calc3z(void);
 void calc3(void);
+void calc23(void);
+void period3(void);
+void check(int NCYCLE, float TIME, swim_writer *wr);
+void writer_init(FILE *fp, int snapshot, swim_writer *wr);
+void writer_start(swim_writer *wr);
+void writer_wait(swim_writer *wr);
+void *writer_thread(void *arg);
 
 int main(){
     FILE *fp;
-    int NCYCLE, i, MNMIN, ICHECK, JCHECK;
-    float TIME, PTIME, PCHECK, UCHECK, VCHECK;
+    int NCYCLE, snapshot;
+    float TIME;
+    char *env;
+    swim_writer wr;
     
     printf("SPEC benchmark 171.swim\n");
     printf("\n");
     
-    if ((fp=fopen("SWIM7","w"))==NULL){
+    if ((fp=fopen("SWIM7","wb"))==NULL){
         printf("No se puede abrir el archivo\n");
         exit(1);}
     
@@ -73,62 +135,49 @@ int main(){
     printf("TIME FILTER PARAMETER %f\n", ALPHA);
     printf("NUMBER OF ITERATIONS %d\n", ITMAX);
     
-    MNMIN = min(M,N);
+    env = getenv("SWIM_SNAPSHOT");
+    snapshot = env != NULL && atoi(env) != 0;
+    writer_init(fp, snapshot, &wr);
 
 /*C  6/22/95 for SPEC: JWR: Initialization of TIME*/
 
     TIME = 0;
-    NCYCLE = 0;
-    
-    BUCLE:    NCYCLE = NCYCLE + 1;
+
+/*  One parallel region runs the whole time loop.  The calc routines
+    are orphaned worksharing loops, NCYCLE is counted by every thread
+    and the diagnostics of printed cycles are summed by all of them in
+    check, then written to SWIM7 in the background.  With -DPROF the
+    main loop of each calc routine is a region of prof.h, and the
+    barrier after it, where a thread waits for the others, another.*/
+
+#pragma omp parallel private(NCYCLE)
+    for(NCYCLE = 1; ; NCYCLE++){
 
 /*     COMPUTE CAPITAL  U, CAPITAL V, Z AND H*/
         
         calc1();
 
+/*     COMPUTE NEW VALUES U,V AND P AND SMOOTH IN ONE SWEEP, UNLESS
+       THE NEW VALUES ARE PRINTED, OR THIS IS THE FIRST OR LAST CYCLE*/
+
+    if(NCYCLE > 1 && NCYCLE < ITMAX && (NCYCLE % MPRINT) != 0){
+        calc23();
+#pragma omp single nowait
+        TIME = TIME + DT;
+        continue;
+    }
+
 /*     COMPUTE NEW VALUES U,V AND P*/
         
         calc2();
         
+#pragma omp single
         TIME = TIME + DT;
-    if((NCYCLE % MPRINT) != 0) goto TESTEND;
-    PTIME = TIME/3600.0;
-
-    /*
-C *** modified for SPEC results verification
-C *** We want to ensure that all calculations were done
-C *** so we "use" all of the computed results.
-C ***
-C *** Since all of the comparisons of the individual diagnal terms
-C *** often differ in the smaller values, the check we have selected
-C *** is to add the absolute values of all terms and print these results
-C*/
-    
-    fprintf(fp, "\n\n%s", "CYCLE NUMBER  ");
-    fprintf(fp, "%d", NCYCLE);
-    fprintf(fp, "\t%s", "MODEL TIME IN  HOURS  ");
-    fprintf(fp, "%f\n\n", PTIME);
-    fprintf(fp, "%s\n\n", "DIAGONAL ELEMENTS OF U");
-    for(i=0;i<MNMIN;i=i+10)
-        fprintf(fp, "%E\t", UNEW[i][i]);
-    fprintf(fp, "%s\n", " ");
-    
-    PCHECK = 0.0;
-    UCHECK = 0.0;
-    VCHECK = 0.0;
-    
-    for(ICHECK=0; ICHECK<MNMIN; ICHECK++){
-        for(JCHECK=0; JCHECK<MNMIN; JCHECK++){
-            PCHECK = PCHECK + fabs(PNEW[ICHECK][JCHECK]);
-            UCHECK = UCHECK + fabs(UNEW[ICHECK][JCHECK]);
-            VCHECK = VCHECK + fabs(VNEW[ICHECK][JCHECK]);}
-        UNEW[ICHECK][ICHECK] = UNEW[ICHECK][ICHECK] * ( (ICHECK%100) /100.0);
-    }
-    printf("\n");
-    printf("Pcheck = %E\nUcheck = %E\nVcheck = %E\n", PCHECK, UCHECK, VCHECK);
+    if((NCYCLE % MPRINT) == 0)
+        check(NCYCLE, TIME, &wr);
 
 /*C        TEST FOR END OF RUN*/
-    TESTEND:      if(NCYCLE >= ITMAX) exit(0);
+    if(NCYCLE >= ITMAX) break;
 
 /*C     TIME SMOOTHING AND UPDATE FOR NEXT CYCLE*/
 
@@ -138,7 +187,13 @@ C*/
     else{
         calc3();}
  
-    goto BUCLE;
+    }
+    
+    writer_wait(&wr);
+    fclose(fp);
+    free(wr.buf);
+    free(pool);
+    return 0;
     
 
 }
@@ -159,7 +214,8 @@ C		compile time.*/
 
 /*CMARIA LEO LOS DATOS DESDE UN FICHERO*/
     FILE *fpin;
-    int i,j;
+    int i,j,k;
+    size_t AS;
     
     if((fpin=fopen("swim.in","r"))==NULL){
         printf("No se piede abrir el archivo\n");
@@ -185,8 +241,52 @@ C		compile time.*/
     DJ = TPI/N;
     PCF = PI*PI*A*A/(EL*EL);
 
+/*  Rows of whole cache lines, but not of a multiple of 4 KB.  Array
+    slots of whole 4 KB pages, plus the cache line of offset.*/
+
+    LD = (NP1+15)/16*16;
+    if(LD % 1024 == 0) LD = LD+16;
+    AS = ((size_t) MP1*LD+1023)/1024*1024+16;
+    if(posix_memalign((void **) &pool, 64, NGRID*AS*sizeof(float)) != 0){
+        printf("No se puede reservar la memoria\n");
+        exit(1);
+    }
+    u = pool;
+    v = u+AS;
+    p = v+AS;
+    unew = p+AS;
+    vnew = unew+AS;
+    pnew = vnew+AS;
+    uold = pnew+AS;
+    vold = uold+AS;
+    pold = vold+AS;
+    cu = pold+AS;
+    cv = cu+AS;
+    z = cv+AS;
+    h = z+AS;
+    psi = h+AS;
+
+    VIEW(U, u);
+    VIEW(V, v);
+    VIEW(P, p);
+    VIEW(UOLD, uold);
+    VIEW(VOLD, vold);
+    VIEW(POLD, pold);
+    VIEW(PSI, psi);
+
+/*  First touch: each row of every array is zeroed by the thread that
+    updates it under the static schedule of the calc routines, so on a
+    NUMA machine the rows are placed in that thread's memory.*/
+
+#pragma omp parallel for private(j,k) schedule(static)
+    for(i=0;i<MP1;i++)
+        for(k=0;k<NGRID;k++)
+            for(j=0;j<LD;j++)
+                pool[k*AS+(size_t) i*LD+j] = 0.0;
+
 /*C     INITIAL VALUES OF THE STREAM FUNCTION AND P*/
     
+#pragma omp parallel for private(j) schedule(static)
     for(i=0;i<MP1;i++)
         for(j=0;j<NP1;j++){
             PSI[i][j] = A*sin((i+.5)*DI)*sin((j+.5)*DJ);
@@ -195,6 +295,7 @@ C		compile time.*/
 
 /*C     INITIALIZE VELOCITIES*/
     
+#pragma omp parallel for private(j) schedule(static)
     for(i=0;i<M;i++)
         for(j=0;j<N;j++){
             U[i+1][j] = -1*(PSI[i+1][j+1]-PSI[i+1][j])/DY;
@@ -213,6 +314,7 @@ C		compile time.*/
     U[0][N] = U[M][0];
     V[M][0] = V[0][N];
     
+#pragma omp parallel for private(j) schedule(static)
     for(i=0;i<MP1;i++)
         for(j=0;j<NP1;j++){
             UOLD[i][j] = U[i][j];
@@ -225,104 +327,263 @@ void calc1(void){
 
     float FSDX, FSDY;
     int I,J;
+    VIEW(U, u);
+    VIEW(V, v);
+    VIEW(P, p);
+    VIEW(CU, cu);
+    VIEW(CV, cv);
+    VIEW(Z, z);
+    VIEW(H, h);
     
     FSDX = 4.0/DX;
     FSDY = 4.0/DY;
 
+    PROF_BEGIN("calc1");
+#pragma omp for nowait schedule(static)
     for (I=0;I<M;I++)
+#pragma omp simd
         for(J=0;J<N;J++){
             CU[I+1][J] = .5*(P[I+1][J]+P[I][J])*U[I+1][J];
             CV[I][J+1] = .5*(P[I][J+1]+P[I][J])*V[I][J+1];
             Z[I+1][J+1] = (FSDX*(V[I+1][J+1]-V[I][J+1])-FSDY*(U[I+1][J+1]-U[I+1][J]))/(P[I][J]+P[I+1][J]+P[I+1][J+1]+P[I][J+1]);
                            H[I][J] = P[I][J]+.25*(U[I+1][J]*U[I+1][J]+U[I][J]*U[I][J]+V[I][J+1]*V[I][J+1]+V[I][J]*V[I][J]);}
-   
+    PROF_END("calc1");
+    PROF_BARRIER("calc1.barrier");
 
 /*C     PERIODIC CONTINUATION*/
+
+/*  The edge rows, edge columns and corners only read points of the
+    loop above, and write disjoint points, so they need no barrier
+    between them.*/
+
+#pragma omp single nowait
+    {
+    CU[0][N] = CU[M][0];
+    CV[M][0] = CV[0][N];
+    Z[0][0] = Z[M][N];
+    H[M][N] = H[0][0];
+    }
           
+#pragma omp for nowait schedule(static)
     for(J=0;J<N;J++){
         CU[0][J] = CU[M][J];
         CV[M][J+1] = CV[0][J+1];
         Z[0][J+1] = Z[M][J+1];
         H[M][J] = H[0][J];}
   
+#pragma omp for schedule(static)
     for(I=0;I<M;I++){
         CU[I+1][N] = CU[I+1][0];
         CV[I][0] = CV[I][N];
         Z[I+1][0] = Z[I+1][N];
         H[I][N] = H[I][0];}
-                           
-    CU[0][N] = CU[M][0];
-    CV[M][0] = CV[0][N];
-    Z[0][0] = Z[M][N];
-    H[M][N] = H[0][0];
 }
 
 void calc2(void){
 /*C        COMPUTE NEW VALUES OF U,V,P*/
     float TDTS8, TDTSDX,TDTSDY;
     int I,J;
+    VIEW(UNEW, unew);
+    VIEW(VNEW, vnew);
+    VIEW(PNEW, pnew);
+    VIEW(UOLD, uold);
+    VIEW(VOLD, vold);
+    VIEW(POLD, pold);
+    VIEW(CU, cu);
+    VIEW(CV, cv);
+    VIEW(Z, z);
+    VIEW(H, h);
     
     TDTS8 = TDT/8.0;
     TDTSDX = TDT/DX;
     TDTSDY = TDT/DY;
 
+    PROF_BEGIN("calc2");
+#pragma omp for nowait schedule(static)
     for(I=0;I<M;I++)
+#pragma omp simd
         for(J=0;J<N;J++){
             UNEW[I+1][J] = UOLD[I+1][J]+TDTS8*(Z[I+1][J+1]+Z[I+1][J])*(CV[I+1][J+1]+CV[I][J+1]+CV[I][J]+CV[I+1][J])-TDTSDX*(H[I+1][J]-H[I][J]);
             VNEW[I][J+1] = VOLD[I][J+1]-TDTS8*(Z[I+1][J+1]+Z[I][J+1])*(CU[I+1][J+1]+CU[I][J+1]+CU[I][J]+CU[I+1][J])-TDTSDY*(H[I][J+1]-H[I][J]);
             PNEW[I][J] = POLD[I][J]-TDTSDX*(CU[I+1][J]-CU[I][J])-TDTSDY*(CV[I][J+1]-CV[I][J]);}
-  
+    PROF_END("calc2");
+    PROF_BARRIER("calc2.barrier");
     
-/*C     PERIODIC CONTINUATION*/
+/*C     PERIODIC CONTINUATION, without barriers as in calc1*/
+
+#pragma omp single nowait
+    {
+    UNEW[0][N] = UNEW[M][0];
+    VNEW[M][0] = VNEW[0][N];
+    PNEW[M][N] = PNEW[0][0];
+    }
 
+#pragma omp for nowait schedule(static)
     for(J=0;J<N;J++){
         UNEW[0][J] = UNEW[M][J];
         VNEW[M][J+1] = VNEW[0][J+1];
         PNEW[M][J] = PNEW[0][J];}
     
+#pragma omp for schedule(static)
     for(I=0;I<M;I++){
         UNEW[I+1][N] = UNEW[I+1][0];
         VNEW[I][0] = VNEW[I][N];
         PNEW[I][N] = PNEW[I][0];}
- 
-    UNEW[0][N] = UNEW[M][0];
-    VNEW[M][0] = VNEW[0][N];
-    PNEW[M][N] = PNEW[0][0];
 }
 
 void calc3z(void){
 /*C         TIME SMOOTHER FOR FIRST ITERATION*/
 
-    int I,J;
-    
+/*  UOLD = U, U = UNEW, by rotation; UNEW gets the dead UOLD arrays*/
+
+    float *T;
+
+#pragma omp single
+    {
     TDT = TDT+TDT;
     
-    for(I=0;I<MP1;I++)
-        for(J=0;J<NP1;J++){
-            UOLD[I][J] = U[I][J];
-            VOLD[I][J] = V[I][J];
-            POLD[I][J] = P[I][J];
-            U[I][J] = UNEW[I][J];
-            V[I][J] = VNEW[I][J];
-            P[I][J] = PNEW[I][J];}
+    T = uold; uold = u; u = unew; unew = T;
+    T = vold; vold = v; v = vnew; vnew = T;
+    T = pold; pold = p; p = pnew; pnew = T;
+    }
     
 }
 
 void calc3(void){
 /*C        TIME SMOOTHING AND UPDATE FOR NEXT CYCLE*/
     int I,J;
+    float *T;
+    VIEW(U, u);
+    VIEW(V, v);
+    VIEW(P, p);
+    VIEW(UNEW, unew);
+    VIEW(VNEW, vnew);
+    VIEW(PNEW, pnew);
+    VIEW(UOLD, uold);
+    VIEW(VOLD, vold);
+    VIEW(POLD, pold);
     
+    PROF_BEGIN("calc3");
+#pragma omp for nowait schedule(static)
     for(I=0;I<M;I++)
+#pragma omp simd
         for(J=0;J<N;J++){
             UOLD[I][J] = U[I][J]+ALPHA*(UNEW[I][J]-2.*U[I][J]+UOLD[I][J]);
             VOLD[I][J] = V[I][J]+ALPHA*(VNEW[I][J]-2.*V[I][J]+VOLD[I][J]);
-            POLD[I][J] = P[I][J]+ALPHA*(PNEW[I][J]-2.*P[I][J]+POLD[I][J]);
-            U[I][J] = UNEW[I][J];
-            V[I][J] = VNEW[I][J];
-            P[I][J] = PNEW[I][J];}
+            POLD[I][J] = P[I][J]+ALPHA*(PNEW[I][J]-2.*P[I][J]+POLD[I][J]);}
+    PROF_END("calc3");
+    PROF_BARRIER("calc3.barrier");
 
-/*C     PERIODIC CONTINUATION*/
+/*  U = UNEW, by swapping the arrays*/
+
+#pragma omp single
+    {
+    T = u; u = unew; unew = T;
+    T = v; v = vnew; vnew = T;
+    T = p; p = pnew; pnew = T;
+    }
+
+    period3();
+}
+
+void calc23(void){
+/*  calc2 followed by calc3, in one sweep over the grid.
+
+    Each point of UNEW, VNEW and PNEW is smoothed into UOLD, VOLD and
+    POLD as soon as it is computed.  Row M and column N of the old
+    values are smoothed needlessly, and then overwritten by period3.
+    Column 0 of VOLD, which needs VNEW[I][N], is left for the end of
+    the row, and row 0 of UOLD, which needs UNEW[M], for after the
+    loop.  Not for cycles whose UNEW is printed, as the checksum loop
+    changes its diagonal.*/
+
+    float TDTS8, TDTSDX,TDTSDY;
+    int I,J;
+    float *T;
+    VIEW(U, u);
+    VIEW(V, v);
+    VIEW(P, p);
+    VIEW(UNEW, unew);
+    VIEW(VNEW, vnew);
+    VIEW(PNEW, pnew);
+    VIEW(UOLD, uold);
+    VIEW(VOLD, vold);
+    VIEW(POLD, pold);
+    VIEW(CU, cu);
+    VIEW(CV, cv);
+    VIEW(Z, z);
+    VIEW(H, h);
+    
+    TDTS8 = TDT/8.0;
+    TDTSDX = TDT/DX;
+    TDTSDY = TDT/DY;
 
+    PROF_BEGIN("calc23");
+#pragma omp for nowait schedule(static)
+    for(I=0;I<M;I++){
+#pragma omp simd
+        for(J=0;J<N;J++){
+            UNEW[I+1][J] = UOLD[I+1][J]+TDTS8*(Z[I+1][J+1]+Z[I+1][J])*(CV[I+1][J+1]+CV[I][J+1]+CV[I][J]+CV[I+1][J])-TDTSDX*(H[I+1][J]-H[I][J]);
+            VNEW[I][J+1] = VOLD[I][J+1]-TDTS8*(Z[I+1][J+1]+Z[I][J+1])*(CU[I+1][J+1]+CU[I][J+1]+CU[I][J]+CU[I+1][J])-TDTSDY*(H[I][J+1]-H[I][J]);
+            PNEW[I][J] = POLD[I][J]-TDTSDX*(CU[I+1][J]-CU[I][J])-TDTSDY*(CV[I][J+1]-CV[I][J]);
+            UOLD[I+1][J] = U[I+1][J]+ALPHA*(UNEW[I+1][J]-2.*U[I+1][J]+UOLD[I+1][J]);
+            VOLD[I][J+1] = V[I][J+1]+ALPHA*(VNEW[I][J+1]-2.*V[I][J+1]+VOLD[I][J+1]);
+            POLD[I][J] = P[I][J]+ALPHA*(PNEW[I][J]-2.*P[I][J]+POLD[I][J]);}
+
+        UNEW[I+1][N] = UNEW[I+1][0];
+        VNEW[I][0] = VNEW[I][N];
+        PNEW[I][N] = PNEW[I][0];
+        VOLD[I][0] = V[I][0]+ALPHA*(VNEW[I][0]-2.*V[I][0]+VOLD[I][0]);
+    }
+    PROF_END("calc23");
+    PROF_BARRIER("calc23.barrier");
+
+#pragma omp single nowait
+    {
+    UNEW[0][N] = UNEW[M][0];
+    VNEW[M][0] = VNEW[0][N];
+    PNEW[M][N] = PNEW[0][0];
+    }
+
+#pragma omp for schedule(static)
+    for(J=0;J<N;J++){
+        UNEW[0][J] = UNEW[M][J];
+        VNEW[M][J+1] = VNEW[0][J+1];
+        PNEW[M][J] = PNEW[0][J];
+        UOLD[0][J] = U[0][J]+ALPHA*(UNEW[0][J]-2.*U[0][J]+UOLD[0][J]);}
+
+#pragma omp single
+    {
+    T = u; u = unew; unew = T;
+    T = v; v = vnew; vnew = T;
+    T = p; p = pnew; pnew = T;
+    }
+
+    period3();
+}
+
+void period3(void){
+/*C     PERIODIC CONTINUATION OF THE SMOOTHED AND NEW VALUES,
+        without barriers as in calc1*/
+    int I,J;
+    VIEW(U, u);
+    VIEW(V, v);
+    VIEW(P, p);
+    VIEW(UOLD, uold);
+    VIEW(VOLD, vold);
+    VIEW(POLD, pold);
+
+#pragma omp single nowait
+    {
+      UOLD[M][N] = UOLD[0][0];
+      VOLD[M][N] = VOLD[0][0];
+      POLD[M][N] = POLD[0][0];
+      U[M][N] = U[0][0];
+      V[M][N] = V[0][0];
+      P[M][N] = P[0][0];
+    }
+
+#pragma omp for nowait schedule(static)
     for(J=0;J<N;J++){
         UOLD[M][J] = UOLD[0][J];
         VOLD[M][J] = VOLD[0][J];
@@ -331,6 +592,7 @@ void calc3(void){
         V[M][J] = V[0][J];
         P[M][J] = P[0][J];}
   
+#pragma omp for schedule(static)
     for(I=0;I<M;I++){
         UOLD[I][N] = UOLD[I][0];
         VOLD[I][N] = VOLD[I][0];
@@ -338,11 +600,131 @@ void calc3(void){
         U[I][N] = U[I][0];
         V[I][N] = V[I][0];
         P[I][N] = P[I][0];}
-    
-      UOLD[M][N] = UOLD[0][0];
-      VOLD[M][N] = VOLD[0][0];
-      POLD[M][N] = POLD[0][0];
-      U[M][N] = U[0][0];
-      V[M][N] = V[0][0];
-      P[M][N] = P[0][0];
+}
+
+void check(int NCYCLE, float TIME, swim_writer *wr){
+/*  The diagnostics of a printed cycle, called by all the threads.
+
+    The rows of the checksum loop are summed in parallel, in double.
+    The record is then handed to the writer thread.*/
+
+    int ICHECK, JCHECK, MNMIN;
+    float *d, *f;
+    VIEW(UNEW, unew);
+    VIEW(VNEW, vnew);
+    VIEW(PNEW, pnew);
+
+    MNMIN = min(M,N);
+    d = wr->buf;
+    f = wr->buf+wr->h.ndiag;
+
+/*  The previous record must be out of BUF*/
+
+#pragma omp single
+    {
+    writer_wait(wr);
+    PCHECK = 0.0;
+    UCHECK = 0.0;
+    VCHECK = 0.0;
+    }
+
+/*  The fields, before the checksum loop changes the diagonal of UNEW*/
+
+    if(wr->h.snapshot){
+#pragma omp for schedule(static)
+        for(ICHECK=0; ICHECK<MP1; ICHECK++){
+            memcpy(f+(size_t) ICHECK*NP1, PNEW[ICHECK], NP1*sizeof(float));
+            memcpy(f+(size_t) (MP1+ICHECK)*NP1, UNEW[ICHECK], NP1*sizeof(float));
+            memcpy(f+(size_t) (2*MP1+ICHECK)*NP1, VNEW[ICHECK], NP1*sizeof(float));}
+    }
+
+    /*
+C *** modified for SPEC results verification
+C *** We want to ensure that all calculations were done
+C *** so we "use" all of the computed results.
+C ***
+C *** Since all of the comparisons of the individual diagnal terms
+C *** often differ in the smaller values, the check we have selected
+C *** is to add the absolute values of all terms and print these results
+C*/
+
+#pragma omp for schedule(static) reduction(+:PCHECK,UCHECK,VCHECK)
+    for(ICHECK=0; ICHECK<MNMIN; ICHECK++){
+        for(JCHECK=0; JCHECK<MNMIN; JCHECK++){
+            PCHECK = PCHECK + fabs(PNEW[ICHECK][JCHECK]);
+            UCHECK = UCHECK + fabs(UNEW[ICHECK][JCHECK]);
+            VCHECK = VCHECK + fabs(VNEW[ICHECK][JCHECK]);}
+        if(ICHECK%10 == 0)
+            d[ICHECK/10] = UNEW[ICHECK][ICHECK];
+        UNEW[ICHECK][ICHECK] = UNEW[ICHECK][ICHECK] * ( (ICHECK%100) /100.0);
+    }
+
+#pragma omp single
+    {
+    wr->r.ncycle = NCYCLE;
+    wr->r.ptime = TIME/3600.0;
+    wr->r.pcheck = PCHECK;
+    wr->r.ucheck = UCHECK;
+    wr->r.vcheck = VCHECK;
+    writer_start(wr);
+
+    printf("\n");
+    printf("Pcheck = %E\nUcheck = %E\nVcheck = %E\n", PCHECK, UCHECK, VCHECK);
+    }
+}
+
+void writer_init(FILE *fp, int snapshot, swim_writer *wr){
+/*  Sets up an idle writer on FP, and writes the header of SWIM7*/
+
+    memset(wr, 0, sizeof(swim_writer));
+    wr->fp = fp;
+    memcpy(wr->h.magic, "SWIMDIA1", 8);
+    wr->h.m = M;
+    wr->h.n = N;
+    wr->h.ndiag = (min(M,N)+9)/10;
+    wr->h.snapshot = snapshot;
+    wr->len = wr->h.ndiag;
+    if(snapshot)
+        wr->len = wr->len+(size_t) 3*MP1*NP1;
+    wr->buf = malloc(wr->len*sizeof(float));
+    if(wr->buf == NULL || fwrite(&wr->h, sizeof(swim_header), 1, fp) != 1){
+        printf("No se puede escribir el archivo SWIM7\n");
+        exit(1);
+    }
+}
+
+void writer_start(swim_writer *wr){
+/*  Starts writing the record in WR->R and WR->BUF in the background.
+    If no thread can be started, writes it right away.*/
+
+    if(pthread_create(&wr->thread, NULL, writer_thread, wr) != 0){
+        writer_thread(wr);
+        return;
+    }
+    wr->busy = 1;
+}
+
+void writer_wait(swim_writer *wr){
+/*  Waits for the record being written, if any*/
+
+    if(wr->busy){
+        pthread_join(wr->thread, NULL);
+        wr->busy = 0;
+    }
+    if(wr->error){
+        printf("No se puede escribir el archivo SWIM7\n");
+        exit(1);
+    }
+}
+
+void *writer_thread(void *arg){
+/*  The writer thread: appends one record to SWIM7*/
+
+    swim_writer *wr = arg;
+
+    if(fwrite(&wr->r, sizeof(swim_record), 1, wr->fp) != 1 ||
+       fwrite(wr->buf, sizeof(float), wr->len, wr->fp) != wr->len ||
+       fflush(wr->fp) != 0)
+        wr->error = 1;
+    return NULL;
 }
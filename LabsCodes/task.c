@@ -1,9 +1,29 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <math.h>
 #include <omp.h>
 
+/*
+   Usage: task [-m mode] [-g grain]
+
+   Trabajos en una lista terminada en 0, de longitud desconocida, que
+   no se puede repartir con omp for.  MODE es:
+
+     serial    el bucle while original
+     batch     un hilo recorre la lista y crea una tarea por cada GRAIN
+               trabajos seguidos; los demas hilos las van ejecutando
+     taskloop  un hilo cuenta los trabajos y los reparte con un
+               taskloop de grainsize GRAIN
+
+   batch por defecto, GRAIN 16 por defecto (1 da una tarea por trabajo).
+   Escribe el tiempo y los trabajos por segundo.
+*/
+
 #define MAX 10000
 #define MAXITER 100000
+#define GRAIN 16
 
 double curra(int n)
 {
@@ -13,28 +33,108 @@ double curra(int n)
     // Algo para que curre un poco
     for(i=0;i<MAXITER;i++)
 	x += sqrt((double) n)/(double) MAX;
- 
+
    return x;
 }
 
+/* El recorrido original, trabajo a trabajo */
+int run_serial(int vector[], double result[])
+{
+   int i = 0;
+
+   while(vector[i]){ // mientras haya curro...
+   	   		    result[i] = curra(vector[i]);
+				i++;}
+   return i;
+}
+
+/* Productor/consumidor: el hilo del single crea una tarea por lote de
+   GRAIN trabajos mientras recorre la lista; los hilos que esperan en la
+   barrera del single las ejecutan.  Las tareas terminan antes de salir
+   de la region paralela. */
+int run_batch(int vector[], double result[], int grain)
+{
+   int i = 0;
+
+#pragma omp parallel
+#pragma omp single
+   {
+      int first, last, k;
+
+      while(vector[i]){
+         first = i;
+         while(vector[i] && i - first < grain)
+            i++;
+         last = i;
+#pragma omp task firstprivate(first, last) private(k)
+         for(k=first;k<last;k++)
+            result[k] = curra(vector[k]);
+      }
+   }
+   return i;
+}
+
+/* Se cuenta primero la lista, y el taskloop reparte los trabajos en
+   tareas de GRAIN */
+int run_taskloop(int vector[], double result[], int grain)
+{
+   int n = 0, k;
+
+   (void) grain;	/* unused when built without OpenMP */
+   while(vector[n])
+      n++;
+
+#pragma omp parallel
+#pragma omp single
+#pragma omp taskloop grainsize(grain)
+   for(k=0;k<n;k++)
+      result[k] = curra(vector[k]);
+
+   return n;
+}
+
 int main(int argc, char* argv[])
 {
-   int input=30, i=0, tid, nthreads;
+   int i=0, n, opt, grain = GRAIN;
+   char *mode = "batch";
    int vector[MAX];
-   double result[MAX];
+   double result[MAX], t, sum;
+
+   while ((opt = getopt(argc, argv, "m:g:")) != -1) {
+      if (opt == 'm')
+         mode = optarg;
+      else if (opt == 'g')
+         grain = atoi(optarg);
+      else
+         grain = 0;
+   }
+   if (grain < 1 || (strcmp(mode, "serial") && strcmp(mode, "batch") &&
+       strcmp(mode, "taskloop"))) {
+      fprintf(stderr, "usage: %s [-m serial|batch|taskloop] [-g grain]\n", argv[0]);
+      return 1;
+   }
 
    for(i=0;i<MAX;i++)
 	vector[i] = i+1;
    vector[MAX-1] = 0;
 
 
-   i = 0;
-   while(vector[i]){ // mientras haya curro...
-   	   		    result[i] = curra(vector[i]);
-				i++;}
+   t = omp_get_wtime();
+   if (strcmp(mode, "serial") == 0)
+      n = run_serial(vector, result);
+   else if (strcmp(mode, "batch") == 0)
+      n = run_batch(vector, result, grain);
+   else
+      n = run_taskloop(vector, result, grain);
+   t = omp_get_wtime() - t;
+
+   sum = 0.0;
+   for(i=0;i<n;i++)
+      sum += result[i];
 
    printf("Resultado para %d = %f \n ", vector[8], result[8]);
- 
+   printf("Suma = %f\n", sum);
+   printf("%s, grano %d, %d hilos: %d trabajos en %f s, %.1f trabajos/s\n",
+          mode, grain, omp_get_max_threads(), n, t, n / t);
+   return 0;
 }
-
-